@@ -23,6 +23,35 @@ options.add_options()
   ("port", "Port of the server hosting the flexer service", cxxopts::value<size_t>())
   ("client", "To specify that flexer is running in client mode")
   ("server", "To specify that flexer is running in server mode")
+  ("jobs", "Number of threads used to scan the sources (default: number of hardware threads)", cxxopts::value<size_t>())
+  ("exclude", "Comma separated list of globs of files and directories to skip (example build,third_party,*/generated/*); .git and .flexer are always skipped", cxxopts::value<std::vector<std::string>>())
+  ("gitignore", "Skip the files and directories ignored by the .gitignore files of the project")
+  ("no-index", "Rescan every file instead of reusing the instances stored in <project-root>/.flexer/index.bin")
+  ("async-log", "Print the log messages from a background thread instead of the logging threads; messages are dropped if a thread logs faster than they are printed")
+  ("log-level", "Minimum level of the messages to print and log: info, warning or error (default: info)", cxxopts::value<std::string>())
+  ("profile", "Print the time spent in each phase of flexer at exit")
+  ("profile-json", "Write the time spent in each phase of flexer at exit to the given JSON file", cxxopts::value<std::string>())
+  ("trace", "Write a Chrome trace of the run (threads, phases and child processes) to the given JSON file, to be opened with chrome://tracing or ui.perfetto.dev", cxxopts::value<std::string>())
+  ("progress-fd", "File descriptor receiving the progress as JSON lines instead of progress bars; by default, JSON lines are printed to stdout when it is not a terminal", cxxopts::value<int>())
+  ("compilation-script", "Executable compiling a variant, run in its workspace with FLEXER_VARIANT, FLEXER_WORKSPACE, FLEXER_PROJECT_ROOT and FLEXER_PARAM_<NAME> in the environment", cxxopts::value<std::string>())
+  ("run-script", "Executable running a compiled variant, in its workspace with the same environment as the compilation script", cxxopts::value<std::string>())
+  ("compile-slots", "Number of variants compiled at the same time (default: --jobs)", cxxopts::value<size_t>())
+  ("run-slots", "Number of variants run at the same time (default: 1)", cxxopts::value<size_t>())
+  ("queue-size", "Maximum number of compiled variants waiting for a run slot, including those being compiled (default: compile slots + run slots)", cxxopts::value<size_t>())
+  ("compile-timeout", "Seconds after which a compilation is terminated (default: none)", cxxopts::value<size_t>())
+  ("run-timeout", "Seconds after which a run is terminated (default: none)", cxxopts::value<size_t>())
+  ("reserved-cores", "CPU list (example 0,1 or 0-3) left to the rest of the system: no compile or run script is scheduled on these CPUs, nor on the other hardware threads of their cores", cxxopts::value<std::vector<std::string>>())
+  ("cores-per-run", "Physical cores, with all their hardware threads, dedicated to each run slot; the compile scripts run on the remaining cores (default: 1)", cxxopts::value<size_t>())
+  ("no-pinning", "Do not give each run slot its own cores: compile and run scripts run on any CPU")
+  ("metric", "Quantity measured on each run of a variant: wall (seconds), cpu (user + system seconds), maxrss (peak KiB) or output (last number printed by the run script) (default: wall)", cxxopts::value<std::string>())
+  ("min-runs", "Minimum number of runs of each variant (default: 3)", cxxopts::value<size_t>())
+  ("max-runs", "Maximum number of runs of each variant (default: 30)", cxxopts::value<size_t>())
+  ("target-width", "The run of a variant is repeated until the 95% bootstrap confidence interval of the median of the metric is narrower than this fraction of the median (default: 0.02)", cxxopts::value<double>())
+  ("cache-dir", "Directory of the compile cache used through the flexer-cc wrapper, exported to the compilation script as FLEXER_CC (default: <project-root>/.flexer/cache)", cxxopts::value<std::string>())
+  ("cache-size", "Size of the compile cache in MiB, the least recently used objects are evicted beyond it (default: 5120)", cxxopts::value<size_t>())
+  ("no-cache", "Do not export the flexer-cc compiler wrapper to the compilation script")
+  ("results", "JSON lines file the outcome, run time and resource usage (CPU time, peak memory, page faults, context switches) of each compiled and run variant are appended to (default: <project-root>/.flexer/results.jsonl)", cxxopts::value<std::string>())
+  ("param", "Values of a ${NAME} parameter of the flexer instances, as NAME=v1,v2,...; repeat for each parameter", cxxopts::value<std::vector<std::string>>())
   ("help", "Show options");
     // clang-format on
 
@@ -3,6 +3,7 @@
 #include <stddef.h>
 
 #include <string>
+#include <utility>
 #include <vector>
 
 // command line config
@@ -21,6 +22,68 @@ extern std::string serverIp;
 extern size_t port;
 extern bool client;
 extern bool server;
+///--jobs
+extern size_t jobs;
+///--exclude, globs of the entries skipped when searching the sources
+extern std::vector<std::string> exclude;
+///--gitignore
+extern bool gitignore;
+///--no-index
+extern bool noIndex;
+///--async-log
+extern bool asyncLog;
+///--log-level, messages of lower levels are discarded (0 info, 1 warning,
+///2 error)
+extern int logLevel;
+///--profile
+extern bool profile;
+///--profile-json
+extern std::string profileJson;
+///--trace
+extern std::string trace;
+///--progress-fd, -1 to print bars when stdout is a terminal and JSON
+///lines otherwise
+extern int progressFd;
+///--compilation-script
+extern std::string compilationScript;
+///--run-script
+extern std::string runScript;
+///--compile-slots, 0 for the number of jobs
+extern size_t compileSlots;
+///--run-slots
+extern size_t runSlots;
+///--queue-size, 0 for compile slots + run slots
+extern size_t queueSize;
+///--compile-timeout, in seconds, 0 for none
+extern size_t compileTimeout;
+///--run-timeout, in seconds, 0 for none
+extern size_t runTimeout;
+///--reserved-cores, CPUs used by neither the compile nor the run scripts
+extern std::vector<int> reservedCores;
+///--cores-per-run, physical cores of each run slot
+extern size_t coresPerRun;
+///--no-pinning
+extern bool pinning;
+///--metric, measured on each run: wall, cpu, maxrss or output
+extern std::string metric;
+///--min-runs
+extern size_t minRuns;
+///--max-runs
+extern size_t maxRuns;
+///--target-width, of the confidence interval of the median relative to
+///the median
+extern double targetWidth;
+///--cache-dir, <project-root>/.flexer/cache if empty
+extern std::string cacheDir;
+///--cache-size, in MiB
+extern size_t cacheSize;
+///--no-cache
+extern bool compileCache;
+///--results, <project-root>/.flexer/results.jsonl if empty
+extern std::string results;
+///--param, values of each template parameter
+extern std::vector<std::pair<std::string, std::vector<std::string>>>
+    params;
 }  // namespace clc
 
 // harm stat
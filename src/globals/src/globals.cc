@@ -1,5 +1,6 @@
 #include "globals.hh"
 
+#include <algorithm>
 #include <limits>
 #include <thread>
 
@@ -14,6 +15,35 @@ std::string serverIp;
 size_t port;
 bool client;
 bool server;
+size_t jobs = std::max(1u, std::thread::hardware_concurrency());
+std::vector<std::string> exclude = {".git", ".flexer"};
+bool gitignore = false;
+bool noIndex = false;
+bool asyncLog = false;
+int logLevel = 0;
+bool profile = false;
+std::string profileJson;
+std::string trace;
+int progressFd = -1;
+std::string compilationScript;
+std::string runScript;
+size_t compileSlots = 0;
+size_t runSlots = 1;
+size_t queueSize = 0;
+size_t compileTimeout = 0;
+size_t runTimeout = 0;
+std::string metric = "wall";
+size_t minRuns = 3;
+size_t maxRuns = 30;
+double targetWidth = 0.02;
+std::string cacheDir;
+size_t cacheSize = 5120;
+bool compileCache = true;
+std::string results;
+std::vector<int> reservedCores;
+size_t coresPerRun = 1;
+bool pinning = true;
+std::vector<std::pair<std::string, std::vector<std::string>>> params;
 }  // namespace clc
 
 namespace hs {
@@ -0,0 +1,37 @@
+#pragma once
+
+#include <cstdint>
+#include <string>
+
+namespace hlog {
+
+/// @brief Severity of an asynchronous log message.
+enum class AsyncLevel : uint8_t { Info, Warning };
+
+/// @brief Starts the background thread printing the log messages.
+/// @details Afterwards, messageInfo and messageWarning do not write to
+/// stdout: each thread pushes its messages, with a raw timestamp, into a
+/// private lock-free ring of ringCapacity messages, drained by the
+/// background thread. A message pushed to a full ring is dropped and
+/// counted.
+void startAsyncLogging(size_t ringCapacity = 4096);
+
+/// @brief Prints the pending messages and stops the background thread;
+/// called at exit and before printing an error.
+void stopAsyncLogging();
+
+/// @brief True between startAsyncLogging and stopAsyncLogging.
+bool asyncLoggingEnabled();
+
+/// @brief Pushes a message of the calling thread.
+/// @param body is the message, already formatted, without the level and
+/// the time.
+/// @return false if asynchronous logging is stopped: the message was not
+/// taken and the caller prints it itself. A message dropped because the
+/// ring is full is only counted.
+bool logAsync(AsyncLevel level, std::string body);
+
+/// @brief Number of messages dropped because a ring was full.
+uint64_t droppedMessages();
+
+} // namespace hlog
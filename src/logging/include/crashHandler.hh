@@ -0,0 +1,44 @@
+#pragma once
+
+namespace hlog {
+
+/// @brief Installs the handlers of the fatal signals (SIGSEGV, SIGBUS,
+/// SIGABRT, SIGFPE, SIGILL).
+/// @details The handlers run on an alternate stack, so that a stack
+/// overflow is reported too. They only use async-signal-safe functions:
+/// they append a record with the signal, the current phase and the
+/// backtrace to the error log, print the symbolized backtrace to stderr
+/// and exit with the number of the signal as exit status.
+void installCrashHandler();
+
+/// @brief Abbreviation of the signal without the SIG prefix ("SEGV"),
+/// nullptr if unknown. Async-signal-safe.
+const char *signalName(int signal);
+
+/// @brief Gives the calling thread its own alternate signal stack; to be
+/// called by every long-lived thread. Released when the thread exits.
+void installAltStack();
+
+/// @brief Sets the phase of the pipeline reported by a crash.
+/// @param phase must be a string with static storage duration.
+void setPhase(const char *phase);
+
+/// @brief Phase set by the last call to setPhase, nullptr if none.
+const char *currentPhase();
+
+/// @brief Sets a phase for the duration of a scope.
+class PhaseScope {
+public:
+  explicit PhaseScope(const char *phase) : _previous(currentPhase()) {
+    setPhase(phase);
+  }
+  ~PhaseScope() { setPhase(_previous); }
+
+  PhaseScope(const PhaseScope &) = delete;
+  PhaseScope &operator=(const PhaseScope &) = delete;
+
+private:
+  const char *_previous;
+};
+
+} // namespace hlog
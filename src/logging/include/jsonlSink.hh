@@ -0,0 +1,58 @@
+#pragma once
+
+#include <cstddef>
+#include <mutex>
+#include <string>
+
+namespace hlog {
+
+/// @brief Append-only JSON lines log: one JSON object per line.
+/// @details The file is opened once, lazily at the first record, in append
+/// mode. Records are buffered in memory and written in large chunks, a
+/// record is never rewritten: the cost of a message does not depend on the
+/// size of the log.
+class JsonlSink {
+public:
+  /// @param path is the file the records are appended to.
+  /// @param bufferSize is the amount of buffered bytes triggering a write.
+  explicit JsonlSink(std::string path, size_t bufferSize = 64 * 1024);
+  ~JsonlSink();
+
+  JsonlSink(const JsonlSink &) = delete;
+  JsonlSink &operator=(const JsonlSink &) = delete;
+
+  /// @brief Appends a record.
+  /// @param record is a JSON object without the trailing newline.
+  /// @param flush forces the buffered records to be written to the file.
+  void append(const std::string &record, bool flush = false);
+
+  /// @brief Writes the buffered records to the file.
+  void flush();
+
+  const std::string &path() const { return _path; }
+
+private:
+  void flushLocked();
+
+  std::string _path;
+  size_t _bufferSize;
+  std::string _buffer;
+  int _fd = -1;
+  bool _failed = false;
+  std::mutex _guard;
+};
+
+/// @brief Appends to out the JSON string literal (quotes included) of str.
+void appendJsonString(std::string &out, const std::string &str);
+
+/// @brief Log of the errors, flushed at every record.
+JsonlSink &errorLog();
+
+/// @brief Log of the warnings, flushed when its buffer is full and at
+/// exit.
+JsonlSink &warningLog();
+
+/// @brief Writes the buffered records of all the logs.
+void flushLogs();
+
+} // namespace hlog
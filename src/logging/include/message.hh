@@ -3,6 +3,8 @@
 
 #include <string>
 
+#include "globals.hh"
+
 namespace hlog {
 
 /// @brief Prints information message.
@@ -25,27 +27,80 @@ void _harm_internal_messageError(const std::string &file,
                                  unsigned int line,
                                  const std::string &message);
 
+#define FLEXER_LOG_LEVEL_INFO 0
+#define FLEXER_LOG_LEVEL_WARNING 1
+#define FLEXER_LOG_LEVEL_ERROR 2
+
+// Messages below FLEXER_MIN_LOG_LEVEL are compiled out: their arguments are
+// still type checked but never evaluated. Errors are never compiled out.
+#ifndef FLEXER_MIN_LOG_LEVEL
+#define FLEXER_MIN_LOG_LEVEL FLEXER_LOG_LEVEL_INFO
+#endif
+
+/// @brief Runtime check of the messages of the given level, done before
+/// evaluating their arguments.
+inline bool logEnabled(int level) {
+  return level >= clc::logLevel &&
+         (level != FLEXER_LOG_LEVEL_INFO || !clc::isilent);
+}
+
+#if FLEXER_MIN_LOG_LEVEL <= FLEXER_LOG_LEVEL_INFO
+#define _HLOG_INFO_ENABLED() hlog::logEnabled(FLEXER_LOG_LEVEL_INFO)
+#else
+#define _HLOG_INFO_ENABLED() false
+#endif
+
+#if FLEXER_MIN_LOG_LEVEL <= FLEXER_LOG_LEVEL_WARNING
+#define _HLOG_WARNING_ENABLED() hlog::logEnabled(FLEXER_LOG_LEVEL_WARNING)
+#else
+#define _HLOG_WARNING_ENABLED() false
+#endif
+
 #define messageInfo(message)                                         \
-  hlog::_harm_internal_messageInfo((message))
+  do {                                                               \
+    if (_HLOG_INFO_ENABLED())                                        \
+      hlog::_harm_internal_messageInfo((message));                   \
+  } while (0)
 
 #define messageInfoIf(condition, message)                            \
-  if (condition)                                                     \
-  hlog::_harm_internal_messageInfo((message))
+  do {                                                               \
+    if (_HLOG_INFO_ENABLED() && (condition))                         \
+      hlog::_harm_internal_messageInfo((message));                   \
+  } while (0)
 
 #define messageWarning(message)                                      \
-  hlog::_harm_internal_messageWarning(__FILE__, __LINE__, (message))
+  do {                                                               \
+    if (_HLOG_WARNING_ENABLED())                                     \
+      hlog::_harm_internal_messageWarning(__FILE__, __LINE__,        \
+                                          (message));                \
+  } while (0)
 
 #define messageWarningIf(condition, message)                         \
-  if (condition)                                                     \
-  hlog::_harm_internal_messageWarning(__FILE__, __LINE__, (message))
+  do {                                                               \
+    if (_HLOG_WARNING_ENABLED() && (condition))                      \
+      hlog::_harm_internal_messageWarning(__FILE__, __LINE__,        \
+                                          (message));                \
+  } while (0)
+
 #define messageError(message)                                        \
   hlog::_harm_internal_messageError(__FILE__, __LINE__, (message))
 
 #define messageErrorIf(condition, message)                           \
-  if (condition)                                                     \
-  hlog::_harm_internal_messageError(__FILE__, __LINE__, (message))
+  do {                                                               \
+    if (condition)                                                   \
+      hlog::_harm_internal_messageError(__FILE__, __LINE__,          \
+                                        (message));                  \
+  } while (0)
 
+/// @brief Appends an error record to the error log and flushes it.
+/// @param custom_errno is recorded with its description, if not -1.
+/// @param custom_signal is recorded with its description, if not -1.
+/// @param withException records the message of the exception being
+/// handled.
 void dumpErrorToFile(std::string message, int custom_errno = -1,
                      int custom_signal = -1,
                      bool withException = false);
+
+/// @brief Appends a warning record to the (buffered) warning log.
+void dumpWarningToFile(const std::string &message);
 } // namespace hlog
@@ -0,0 +1,262 @@
+#include <time.h>
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <cstdio>
+#include <cstdlib>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+#include "asyncLog.hh"
+
+namespace hlog {
+
+namespace {
+
+struct Record {
+  int64_t timeNs;
+  AsyncLevel level;
+  std::string body;
+};
+
+/// Single-producer single-consumer ring: the owner thread pushes, the
+/// thread holding the drain lock pops.
+struct Ring {
+  explicit Ring(size_t capacity) : slots(capacity), mask(capacity - 1) {}
+
+  bool push(Record &&record) {
+    size_t tail = _tail.load(std::memory_order_relaxed);
+    if (tail - _head.load(std::memory_order_acquire) == slots.size()) {
+      return false;
+    }
+    slots[tail & mask] = std::move(record);
+    _tail.store(tail + 1, std::memory_order_release);
+    return true;
+  }
+
+  /// move the pending records to out, return false if there were none
+  bool pop(std::vector<Record> &out) {
+    size_t head = _head.load(std::memory_order_relaxed);
+    size_t tail = _tail.load(std::memory_order_acquire);
+    for (size_t i = head; i != tail; i++) {
+      out.push_back(std::move(slots[i & mask]));
+    }
+    _head.store(tail, std::memory_order_release);
+    return head != tail;
+  }
+
+  std::vector<Record> slots;
+  size_t mask;
+  std::atomic<bool> ownerAlive{true};
+
+private:
+  alignas(64) std::atomic<size_t> _head{0};
+  alignas(64) std::atomic<size_t> _tail{0};
+};
+
+struct AsyncLogger {
+  std::atomic<bool> enabled{false};
+  // threads inside logAsync, waited for by the final drain
+  std::atomic<size_t> pushing{0};
+  size_t ringCapacity = 0;
+  std::atomic<uint64_t> dropped{0};
+
+  // rings of the live threads and of the dead ones not drained yet
+  std::mutex ringsGuard;
+  std::vector<std::shared_ptr<Ring>> rings;
+
+  // only one thread at a time consumes the rings
+  std::mutex drainGuard;
+  std::vector<Record> batch;
+  std::string out;
+  time_t cachedSecond = -1;
+  char cachedTime[32] = "";
+
+  std::thread writer;
+  std::mutex wakeGuard;
+  std::condition_variable wake;
+  std::atomic<bool> pending{false};
+  bool stopping = false;
+};
+
+// never destroyed: threads can log while static objects are destroyed
+AsyncLogger &logger() {
+  static AsyncLogger *instance = new AsyncLogger();
+  return *instance;
+}
+
+/// ring of the calling thread, released to the writer when the thread
+/// exits
+struct ThreadRing {
+  ~ThreadRing() {
+    if (ring) {
+      ring->ownerAlive.store(false, std::memory_order_release);
+    }
+  }
+  std::shared_ptr<Ring> ring;
+};
+
+Ring &threadRing() {
+  thread_local ThreadRing local;
+  if (!local.ring) {
+    AsyncLogger &l = logger();
+    local.ring = std::make_shared<Ring>(l.ringCapacity);
+    std::lock_guard<std::mutex> lock{l.ringsGuard};
+    l.rings.push_back(local.ring);
+  }
+  return *local.ring;
+}
+
+int64_t nowNs() {
+  struct timespec ts;
+  clock_gettime(CLOCK_REALTIME, &ts);
+  return static_cast<int64_t>(ts.tv_sec) * 1000000000 + ts.tv_nsec;
+}
+
+const char *formatTime(AsyncLogger &l, int64_t timeNs) {
+  time_t second = static_cast<time_t>(timeNs / 1000000000);
+  if (second != l.cachedSecond) {
+    tm r;
+    strftime(l.cachedTime, sizeof(l.cachedTime), "%X",
+             localtime_r(&second, &r));
+    l.cachedSecond = second;
+  }
+  return l.cachedTime;
+}
+
+/// print the pending messages of all the threads, in time order
+void drain(AsyncLogger &l) {
+  std::lock_guard<std::mutex> lock{l.drainGuard};
+  l.batch.clear();
+  {
+    std::lock_guard<std::mutex> ringsLock{l.ringsGuard};
+    auto ring = l.rings.begin();
+    while (ring != l.rings.end()) {
+      // seen dead before the pop: the owner pushed its last message before
+      // dying, the pop gets it and the ring is empty for good
+      bool dead = !(*ring)->ownerAlive.load(std::memory_order_acquire);
+      (*ring)->pop(l.batch);
+      ring = dead ? l.rings.erase(ring) : ring + 1;
+    }
+  }
+  if (l.batch.empty()) {
+    return;
+  }
+
+  std::stable_sort(l.batch.begin(), l.batch.end(),
+                   [](const Record &a, const Record &b) {
+                     return a.timeNs < b.timeNs;
+                   });
+  l.out.clear();
+  for (const auto &record : l.batch) {
+    l.out += record.level == AsyncLevel::Info ? "\e[1m[INFO] "
+                                              : "\033[1;33m[WARNING] ";
+    l.out += formatTime(l, record.timeNs);
+    l.out += " - ";
+    l.out += record.body;
+    l.out += "\n\033[0m";
+  }
+  fwrite(l.out.data(), 1, l.out.size(), stdout);
+  fflush(stdout);
+}
+
+void writerLoop(AsyncLogger &l) {
+  while (true) {
+    {
+      std::unique_lock<std::mutex> lock{l.wakeGuard};
+      // producers notify without the lock: a lost wakeup is recovered by
+      // the timeout
+      l.wake.wait_for(lock, std::chrono::milliseconds(50),
+                      [&l] { return l.stopping || l.pending.load(); });
+      if (l.stopping) {
+        break;
+      }
+    }
+    l.pending.exchange(false);
+    drain(l);
+  }
+  drain(l);
+}
+
+} // namespace
+
+void startAsyncLogging(size_t ringCapacity) {
+  AsyncLogger &l = logger();
+  if (l.enabled) {
+    return;
+  }
+  // round up to a power of two
+  l.ringCapacity = 1;
+  while (l.ringCapacity < std::max<size_t>(ringCapacity, 2)) {
+    l.ringCapacity <<= 1;
+  }
+  l.stopping = false;
+  l.writer = std::thread(writerLoop, std::ref(l));
+  l.enabled = true;
+
+  static bool stopAtExit = (std::atexit(stopAsyncLogging), true);
+  (void)stopAtExit;
+}
+
+void stopAsyncLogging() {
+  AsyncLogger &l = logger();
+  if (!l.enabled.exchange(false)) {
+    return;
+  }
+  // a thread that saw enabled before the exchange may still be pushing:
+  // its message must be in a ring before the final drain
+  while (l.pushing.load() != 0) {
+    std::this_thread::yield();
+  }
+  {
+    std::lock_guard<std::mutex> lock{l.wakeGuard};
+    l.stopping = true;
+  }
+  l.wake.notify_one();
+  if (l.writer.joinable()) {
+    if (l.writer.get_id() == std::this_thread::get_id()) {
+      l.writer.detach();
+    } else {
+      l.writer.join();
+    }
+  }
+  drain(l);
+
+  if (uint64_t dropped = l.dropped.load()) {
+    fprintf(stdout,
+            "\033[1;33m[WARNING] %llu log messages were dropped: the "
+            "threads logged faster than they could be printed\n\033[0m",
+            static_cast<unsigned long long>(dropped));
+    fflush(stdout);
+  }
+}
+
+bool asyncLoggingEnabled() {
+  return logger().enabled.load(std::memory_order_relaxed);
+}
+
+bool logAsync(AsyncLevel level, std::string body) {
+  AsyncLogger &l = logger();
+  // sequentially consistent with the exchange of stopAsyncLogging: either
+  // the stop waits for this push, or this call sees the logger stopped
+  l.pushing.fetch_add(1);
+  if (!l.enabled.load()) {
+    l.pushing.fetch_sub(1);
+    return false;
+  }
+  if (!threadRing().push({nowNs(), level, std::move(body)})) {
+    l.dropped.fetch_add(1, std::memory_order_relaxed);
+  } else if (!l.pending.exchange(true, std::memory_order_acq_rel)) {
+    l.wake.notify_one();
+  }
+  l.pushing.fetch_sub(1);
+  return true;
+}
+
+uint64_t droppedMessages() { return logger().dropped.load(); }
+
+} // namespace hlog
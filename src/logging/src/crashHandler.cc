@@ -0,0 +1,282 @@
+#include <errno.h>
+#include <execinfo.h>
+#include <fcntl.h>
+#include <signal.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+#include <atomic>
+#include <cstdint>
+#include <memory>
+
+#include "crashHandler.hh"
+
+namespace hlog {
+
+namespace {
+
+constexpr int fatalSignals[] = {SIGSEGV, SIGBUS, SIGABRT, SIGFPE, SIGILL};
+constexpr size_t maxFrames = 64;
+// same file as errorLog()
+constexpr const char *errorLogPath = "error.jsonl";
+
+std::atomic<const char *> phase{nullptr};
+// offset of the local time from UTC, computed when installing the handler:
+// localtime is not async-signal-safe
+long utcOffset = 0;
+
+/// fixed-size line assembled without allocating
+class SignalSafeLine {
+public:
+  void append(const char *s) {
+    while (*s) {
+      put(*s++);
+    }
+  }
+
+  /// append s as the content of a JSON string
+  void appendEscaped(const char *s) {
+    for (; *s; s++) {
+      if (*s == '"' || *s == '\\') {
+        put('\\');
+        put(*s);
+      } else if (static_cast<unsigned char>(*s) < 0x20) {
+        put(' ');
+      } else {
+        put(*s);
+      }
+    }
+  }
+
+  void appendDecimal(uint64_t value, int minDigits = 1) {
+    char digits[20];
+    int n = 0;
+    do {
+      digits[n++] = static_cast<char>('0' + value % 10);
+      value /= 10;
+    } while (value != 0 || n < minDigits);
+    while (n > 0) {
+      put(digits[--n]);
+    }
+  }
+
+  void appendHex(uintptr_t value) {
+    static const char hex[] = "0123456789abcdef";
+    append("0x");
+    char digits[2 * sizeof(uintptr_t)];
+    int n = 0;
+    do {
+      digits[n++] = hex[value & 0xf];
+      value >>= 4;
+    } while (value != 0);
+    while (n > 0) {
+      put(digits[--n]);
+    }
+  }
+
+  void writeTo(int fd) const {
+    size_t done = 0;
+    while (done < _size) {
+      ssize_t written = ::write(fd, _data + done, _size - done);
+      if (written < 0) {
+        if (errno == EINTR) {
+          continue;
+        }
+        return;
+      }
+      done += static_cast<size_t>(written);
+    }
+  }
+
+private:
+  void put(char c) {
+    if (_size < sizeof(_data)) {
+      _data[_size++] = c;
+    }
+  }
+
+  char _data[4096];
+  size_t _size = 0;
+};
+
+void appendTime(SignalSafeLine &line) {
+  struct timespec now;
+  clock_gettime(CLOCK_REALTIME, &now);
+  long secondOfDay = ((now.tv_sec + utcOffset) % 86400 + 86400) % 86400;
+  line.appendDecimal(secondOfDay / 3600, 2);
+  line.append(":");
+  line.appendDecimal(secondOfDay / 60 % 60, 2);
+  line.append(":");
+  line.appendDecimal(secondOfDay % 60, 2);
+}
+
+void crashHandler(int signal) {
+  int savedErrno = errno;
+
+  void *frames[maxFrames];
+  int nFrames = backtrace(frames, maxFrames);
+
+  // same record as dumpErrorToFile, plus the phase and the raw backtrace
+  SignalSafeLine line;
+  line.append("{\"time\":\"");
+  appendTime(line);
+  line.append("\",\"message\":\"Abnormal termination with a signal\"");
+  line.append(",\"signal\":[\"");
+  line.appendDecimal(static_cast<uint64_t>(signal));
+  line.append("\",\"");
+  line.appendEscaped(signalName(signal) ? signalName(signal) : "?");
+  line.append("\"]");
+  if (const char *p = phase.load(std::memory_order_relaxed)) {
+    line.append(",\"phase\":\"");
+    line.appendEscaped(p);
+    line.append("\"");
+  }
+  line.append(",\"backtrace\":[");
+  for (int i = 0; i < nFrames; i++) {
+    line.append(i == 0 ? "\"" : ",\"");
+    line.appendHex(reinterpret_cast<uintptr_t>(frames[i]));
+    line.append("\"");
+  }
+  line.append("]}\n");
+
+  int fd = ::open(errorLogPath, O_WRONLY | O_CREAT | O_APPEND | O_CLOEXEC,
+                  0666);
+  if (fd >= 0) {
+    line.writeTo(fd);
+    ::close(fd);
+  }
+
+  SignalSafeLine header;
+  header.append("\033[1;31m[ERROR] Abnormal termination with signal ");
+  header.appendDecimal(static_cast<uint64_t>(signal));
+  header.append(" (");
+  header.append(signalName(signal) ? signalName(signal) : "?");
+  header.append(")");
+  if (const char *p = phase.load(std::memory_order_relaxed)) {
+    header.append(" while ");
+    header.append(p);
+  }
+  header.append("\n\033[0m");
+  header.writeTo(STDERR_FILENO);
+  backtrace_symbols_fd(frames, nFrames, STDERR_FILENO);
+
+  // exit with the number of the signal, as the forking supervisor did
+  errno = savedErrno;
+  _exit(signal);
+}
+
+struct AltStack {
+  ~AltStack() {
+    if (memory) {
+      stack_t disable;
+      memset(&disable, 0, sizeof(disable));
+      disable.ss_flags = SS_DISABLE;
+      sigaltstack(&disable, nullptr);
+    }
+  }
+  std::unique_ptr<char[]> memory;
+};
+
+} // namespace
+
+void installAltStack() {
+  thread_local AltStack altStack;
+  if (altStack.memory) {
+    return;
+  }
+  // SIGSTKSZ is not a constant anymore and is too small for backtrace
+  const size_t size = 64 * 1024;
+  altStack.memory.reset(new char[size]);
+  stack_t stack;
+  memset(&stack, 0, sizeof(stack));
+  stack.ss_sp = altStack.memory.get();
+  stack.ss_size = size;
+  if (sigaltstack(&stack, nullptr) != 0) {
+    altStack.memory.reset();
+  }
+}
+
+void installCrashHandler() {
+  time_t now = time(nullptr);
+  struct tm local;
+  localtime_r(&now, &local);
+  utcOffset = local.tm_gmtoff;
+
+  // the first call of backtrace loads libgcc, which allocates: do it now
+  void *frames[1];
+  backtrace(frames, 1);
+
+  installAltStack();
+
+  struct sigaction action;
+  memset(&action, 0, sizeof(action));
+  action.sa_handler = crashHandler;
+  action.sa_flags = SA_ONSTACK;
+  sigemptyset(&action.sa_mask);
+  for (int signal : fatalSignals) {
+    sigaction(signal, &action, nullptr);
+  }
+}
+
+const char *signalName(int signal) {
+  // sigabbrev_np needs glibc 2.32
+  switch (signal) {
+  case SIGHUP:
+    return "HUP";
+  case SIGINT:
+    return "INT";
+  case SIGQUIT:
+    return "QUIT";
+  case SIGILL:
+    return "ILL";
+  case SIGTRAP:
+    return "TRAP";
+  case SIGABRT:
+    return "ABRT";
+  case SIGBUS:
+    return "BUS";
+  case SIGFPE:
+    return "FPE";
+  case SIGKILL:
+    return "KILL";
+  case SIGUSR1:
+    return "USR1";
+  case SIGSEGV:
+    return "SEGV";
+  case SIGUSR2:
+    return "USR2";
+  case SIGPIPE:
+    return "PIPE";
+  case SIGALRM:
+    return "ALRM";
+  case SIGTERM:
+    return "TERM";
+  case SIGCHLD:
+    return "CHLD";
+  case SIGCONT:
+    return "CONT";
+  case SIGSTOP:
+    return "STOP";
+  case SIGTSTP:
+    return "TSTP";
+  case SIGTTIN:
+    return "TTIN";
+  case SIGTTOU:
+    return "TTOU";
+  case SIGXCPU:
+    return "XCPU";
+  case SIGXFSZ:
+    return "XFSZ";
+  case SIGSYS:
+    return "SYS";
+  default:
+    return nullptr;
+  }
+}
+
+void setPhase(const char *p) { phase.store(p, std::memory_order_relaxed); }
+
+const char *currentPhase() { return phase.load(std::memory_order_relaxed); }
+
+} // namespace hlog
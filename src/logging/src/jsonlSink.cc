@@ -0,0 +1,129 @@
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <iostream>
+
+#include "jsonlSink.hh"
+
+namespace hlog {
+
+JsonlSink::JsonlSink(std::string path, size_t bufferSize)
+    : _path(std::move(path)), _bufferSize(bufferSize) {
+  _buffer.reserve(_bufferSize);
+}
+
+JsonlSink::~JsonlSink() {
+  flush();
+  if (_fd >= 0) {
+    ::close(_fd);
+  }
+}
+
+void JsonlSink::append(const std::string &record, bool flush) {
+  std::lock_guard<std::mutex> lock{_guard};
+  _buffer += record;
+  _buffer += '\n';
+  if (flush || _buffer.size() >= _bufferSize) {
+    flushLocked();
+  }
+}
+
+void JsonlSink::flush() {
+  std::lock_guard<std::mutex> lock{_guard};
+  flushLocked();
+}
+
+void JsonlSink::flushLocked() {
+  if (_buffer.empty()) {
+    return;
+  }
+  if (_fd < 0 && !_failed) {
+    _fd = ::open(_path.c_str(), O_WRONLY | O_CREAT | O_APPEND | O_CLOEXEC,
+                 0666);
+    if (_fd < 0) {
+      // cannot report it through the logs: print it once and drop records
+      _failed = true;
+      std::cerr << "Failed to open log file: " << _path << " ("
+                << strerror(errno) << ")\n";
+    }
+  }
+
+  const char *data = _buffer.data();
+  size_t left = _buffer.size();
+  while (_fd >= 0 && left > 0) {
+    ssize_t written = ::write(_fd, data, left);
+    if (written < 0) {
+      if (errno == EINTR) {
+        continue;
+      }
+      std::cerr << "Failed to write log file: " << _path << " ("
+                << strerror(errno) << ")\n";
+      break;
+    }
+    data += written;
+    left -= static_cast<size_t>(written);
+  }
+  _buffer.clear();
+}
+
+void appendJsonString(std::string &out, const std::string &str) {
+  static const char hex[] = "0123456789abcdef";
+  out += '"';
+  for (char c : str) {
+    switch (c) {
+    case '"':
+      out += "\\\"";
+      break;
+    case '\\':
+      out += "\\\\";
+      break;
+    case '\n':
+      out += "\\n";
+      break;
+    case '\r':
+      out += "\\r";
+      break;
+    case '\t':
+      out += "\\t";
+      break;
+    default:
+      if (static_cast<unsigned char>(c) < 0x20) {
+        out += "\\u00";
+        out += hex[(c >> 4) & 0xf];
+        out += hex[c & 0xf];
+      } else {
+        out += c;
+      }
+    }
+  }
+  out += '"';
+}
+
+// The sinks are never destroyed: messages can still be logged by the
+// destructors of other static objects. Their buffers are flushed at exit.
+static JsonlSink &makeSink(const char *path) {
+  static bool flushAtExit = (std::atexit(flushLogs), true);
+  (void)flushAtExit;
+  return *new JsonlSink(path);
+}
+
+JsonlSink &errorLog() {
+  static JsonlSink &sink = makeSink("error.jsonl");
+  return sink;
+}
+
+JsonlSink &warningLog() {
+  static JsonlSink &sink = makeSink("warning.jsonl");
+  return sink;
+}
+
+void flushLogs() {
+  warningLog().flush();
+  errorLog().flush();
+}
+
+} // namespace hlog
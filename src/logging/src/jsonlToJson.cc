@@ -0,0 +1,66 @@
+// Converts JSON lines logs (error.jsonl, warning.jsonl) to a JSON array,
+// for the tools expecting the old log format.
+//
+//   flexer-log2json <log.jsonl>... [-o <out.json>]
+
+#include <cstring>
+#include <fstream>
+#include <iostream>
+#include <string>
+#include <vector>
+
+static void printUsage(const char *program) {
+  std::cerr << "Usage: " << program << " <log.jsonl>... [-o <out.json>]\n";
+}
+
+int main(int argc, char *argv[]) {
+  std::vector<std::string> inputs;
+  std::string output;
+  for (int i = 1; i < argc; i++) {
+    if (std::strcmp(argv[i], "-o") == 0 && i + 1 < argc) {
+      output = argv[++i];
+    } else if (std::strcmp(argv[i], "-h") == 0 ||
+               std::strcmp(argv[i], "--help") == 0) {
+      printUsage(argv[0]);
+      return 0;
+    } else {
+      inputs.push_back(argv[i]);
+    }
+  }
+  if (inputs.empty()) {
+    printUsage(argv[0]);
+    return 1;
+  }
+
+  std::ofstream outFile;
+  if (!output.empty()) {
+    outFile.open(output, std::ios::trunc);
+    if (!outFile.is_open()) {
+      std::cerr << "Error opening file for writing: " << output << "\n";
+      return 1;
+    }
+  }
+  std::ostream &out = output.empty() ? std::cout : outFile;
+
+  // every line is already a JSON object: only the separators are added
+  out << "[";
+  bool first = true;
+  for (const auto &input : inputs) {
+    std::ifstream in(input);
+    if (!in.is_open()) {
+      std::cerr << "Error opening file: " << input << "\n";
+      return 1;
+    }
+    std::string line;
+    while (std::getline(in, line)) {
+      if (line.find_first_not_of(" \t\r") == std::string::npos) {
+        continue;
+      }
+      out << (first ? "\n" : ",\n") << line;
+      first = false;
+    }
+  }
+  out << "\n]\n";
+
+  return out ? 0 : 1;
+}
@@ -5,11 +5,12 @@
 #include <sys/time.h>
 #include <time.h>
 
+#include "asyncLog.hh"
 #include "globals.hh"
+#include "jsonlSink.hh"
 #include "message.hh"
-#include "misc.hh"
 #include <cstring>
-#include <fstream>
+#include <exception>
 
 namespace hlog {
 
@@ -26,85 +27,51 @@ std::string NowTime() {
 
 void dumpErrorToFile(std::string message, int custom_errno,
                      int custom_signal, bool withException) {
-
-  if (!isFileEmpty("error.log")) {
-    deleteLastLine("error.log");
-    std::ofstream file;
-    file.open("error.log", std::ios::app);
-    file << ",\n";
-    file.close();
-  } else {
-    std::ofstream file;
-    file.open("error.log", std::ios::app);
-    file << "[\n";
-    file.close();
-  }
-
-  removeDoubleQuotes(message);
-
-  std::ofstream file;
-  file.open("error.log", std::ios::app);
-  file << "{\n";
-  file << "\"time\" : \"" << NowTime() << "\"," << std::endl;
-  file << "\"message\" : \"" << message << "\"";
+  std::string record = "{\"time\":\"" + NowTime() + "\",\"message\":";
+  appendJsonString(record, message);
 
   if (custom_signal != -1) {
-    file << ",\n\"signal\" : [\"" << custom_signal << "\",\""
-         << strsignal(custom_signal) << "\"]";
+    record += ",\"signal\":[\"" + std::to_string(custom_signal) + "\",";
+    appendJsonString(record, strsignal(custom_signal));
+    record += "]";
   }
 
-  if (withException) {
+  if (withException && std::current_exception()) {
     try {
       throw; // Re-throw the current exception
     } catch (const std::exception &ex) {
-      file << ",\n\"exception\" : \"" << ex.what() << "\"";
+      record += ",\"exception\":";
+      appendJsonString(record, ex.what());
+    } catch (...) {
     }
   }
 
   if (custom_errno != -1) {
-    file << ",\n\"errno\" : [\"" << custom_errno << "\",\""
-         << strerror(custom_errno) << "\"]";
+    record += ",\"errno\":[\"" + std::to_string(custom_errno) + "\",";
+    appendJsonString(record, strerror(custom_errno));
+    record += "]";
   }
 
-  file << "\n";
-
-  file << "}\n";
-
-  file << "]\n";
+  record += "}";
 
-  file.close();
+  // the process is about to die: write the pending warnings too
+  warningLog().flush();
+  errorLog().append(record, true);
 }
 
-void dumpWarningToFile(std::string message) {
-
-  if (!isFileEmpty("warning.log")) {
-    deleteLastLine("warning.log");
-    std::ofstream file;
-    file.open("warning.log", std::ios::app);
-    file << ",\n";
-    file.close();
-  } else {
-    std::ofstream file;
-    file.open("warning.log", std::ios::app);
-    file << "[\n";
-    file.close();
-  }
-
-  removeDoubleQuotes(message);
-
-  std::ofstream file;
-  file.open("warning.log", std::ios::app);
-  file << "{\n";
-  file << "\"time\" : \"" << NowTime() << "\"," << std::endl;
-  file << "\"message\" : \"" << message << "\"";
-  file << "}\n";
-  file << "]\n";
-
-  file.close();
+void dumpWarningToFile(const std::string &message) {
+  std::string record = "{\"time\":\"" + NowTime() + "\",\"message\":";
+  appendJsonString(record, message);
+  record += "}";
+  warningLog().append(record);
 }
 
 void _harm_internal_messageInfo(const std::string &message) {
   if (clc::isilent == 0) {
+    if (asyncLoggingEnabled() &&
+        logAsync(AsyncLevel::Info, "Message: " + message)) {
+      return;
+    }
     std::cout << "\e[1m[INFO] " << NowTime() << " - "
               << "Message: " << message << std::endl
               << "\033[0m";
@@ -118,6 +85,12 @@ void _harm_internal_messageWarning(const std::string &file,
   dumpWarningToFile(message);
 
   if (clc::wsilent == 0) {
+    if (asyncLoggingEnabled() &&
+        logAsync(AsyncLevel::Warning, "File: " + file + " -- Line: " +
+                                          std::to_string(line) +
+                                          "\n\tMessage: " + message)) {
+      return;
+    }
     std::cout << "\033[1;33m[WARNING] " << NowTime() << " - "
               << "File: " << file << " -- "
               << "Line: " << line << std::endl
@@ -133,6 +106,8 @@ void _harm_internal_messageError(const std::string &file,
                                  const std::string &message) {
 
   dumpErrorToFile(message);
+  // print the messages preceding the error first
+  stopAsyncLogging();
 
   std::cerr << "\033[1;31m[ERROR] " << NowTime() << " - "
             << "File: " << file << " "
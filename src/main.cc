@@ -1,23 +1,41 @@
+#include <fcntl.h>
 #include <stdlib.h>
-#include <sys/types.h>
-#include <sys/wait.h>
-#include <unistd.h>
 
 #include <algorithm>
+#include <atomic>
+#include <chrono>
 #include <csignal>
+#include <cstdio>
+#include <ctime>
 #include <filesystem>
 #include <fstream>
 #include <iostream>
+#include <memory>
+#include <mutex>
 #include <ostream>
 #include <string>
+#include <unordered_set>
 #include <utility>
 #include <vector>
 
+#include "asyncLog.hh"
 #include "commandLineParser.hh"
+#include "compileCache.hh"
+#include "cpuAllocator.hh"
+#include "crashHandler.hh"
+#include "directoryWalker.hh"
 #include "flexerIcon.hh"
 #include "globals.hh"
+#include "instanceIndex.hh"
+#include "jsonlSink.hh"
+#include "measurement.hh"
 #include "message.hh"
+#include "parameterSweep.hh"
+#include "profiler.hh"
 #include "text.hh"
+#include "trace.hh"
+#include "variantScheduler.hh"
+#include "workspace.hh"
 
 /// @brief handle all the command line arguments
 static void parseCommandLineArguments(int argc, char* args[]);
@@ -28,42 +46,28 @@ void exceptionHandler();
 /// @brief handles all the unhandled errors
 void handleErrors();
 
-using namespace flexer;
+/// @brief prints or exports the profile, registered with atexit
+void reportProfile();
 
-namespace fs = std::filesystem;
+/// @brief writes the trace, registered with atexit
+void writeTrace();
 
-std::vector<std::string> findFilesWithExtensions(
-    const std::string& directoryPath,
-    const std::vector<std::string>& extensions) {
-  std::vector<std::string> matchingFilePaths;
-
-  try {
-    for (const auto& entry : fs::recursive_directory_iterator(directoryPath)) {
-      if (fs::is_regular_file(entry.path())) {
-        std::string fileSuffix = entry.path().extension().string();
-        // Convert to lowercase for case-insensitive matching
-        std::transform(fileSuffix.begin(), fileSuffix.end(), fileSuffix.begin(),
-                       ::tolower);
-
-        for (const auto& extension : extensions) {
-          if (fileSuffix == extension) {
-            matchingFilePaths.push_back(entry.path().string());
-            break;  // Move to the next file after a match is found
-          }
-        }
-      }
-    }
-  } catch (const std::exception& e) {
-    std::cerr << "Error: " << e.what() << std::endl;
-  }
+using namespace flexer;
 
-  return matchingFilePaths;
-}
+/// @brief compiles and runs every variant of the parameter sweep
+void exploreVariants(const std::vector<FlexerInstance>& instances);
+
+namespace fs = std::filesystem;
 
 std::vector<std::string> findFiles() {
   std::vector<std::string> inFiles;
   if (!clc::include.empty()) {
-    inFiles = findFilesWithExtensions(clc::projectRoot, clc::include);
+    WalkOptions options;
+    options.extensions = clc::include;
+    options.excludes = clc::exclude;
+    options.gitignore = clc::gitignore;
+    options.jobs = clc::jobs;
+    inFiles = findFilesWithExtensions(clc::projectRoot, options);
     messageErrorIf(inFiles.empty(),
                    "No files found in the directory: " + clc::projectRoot);
   } else {
@@ -89,118 +93,280 @@ int main(int arg, char* argv[]) {
   // print welcome message
   std::cout << getIcon() << "\n";
 
+  hlog::setPhase("parsing the command line");
   parseCommandLineArguments(arg, argv);
 
+  if (clc::asyncLog) {
+    hlog::startAsyncLogging();
+  }
+  if (clc::profile || !clc::profileJson.empty()) {
+    Profiler::enable();
+    std::atexit(reportProfile);
+  }
+  if (!clc::trace.empty()) {
+    Tracer::enable();
+    std::atexit(writeTrace);
+  }
+
   if (clc::client) {
     messageInfo("Client mode");
   } else if (clc::server) {
     messageInfo("Server mode");
   }
 
-  //  // find all the files with the given extensions------------
-  //  std::vector<std::string> inFiles = findFiles();
-  //
-  //  auto instances = extractFlexerInstances(inFiles);
-  //  messageErrorIf(instances.empty(), "No flexer instances found");
-  //
-  //  // debug
-  //  // for (const auto& [id, text, startLine, endLine, fileName] : instances)
-  //  {
-  //  //   std::cout << "ID: " << id << "\n";
-  //  //   std::cout << "Text: \n" << text << "\n";
-  //  //   std::cout << "Start line: " << startLine << "\n";
-  //  //   std::cout << "End line: " << endLine << "\n";
-  //  //   std::cout << "File: " << fileName << "\n";
-  //  // }
-  //
-  //  std::unordered_map<std::string, std::vector<FlexerInstance>>
-  //  toBeSubstituted =
-  //      organizeInstances(instances);
-  //
-  //  std::unordered_map<std::string, std::vector<FlexerInstance>> subtitutions
-  //  =
-  //      toBeSubstituted;
-  //
-  //  size_t i = 0;
-  //  for (auto& [file, instances] : subtitutions) {
-  //    for (auto& instance : instances) {
-  //      instance.text = "substitution_" + std::to_string(i++) + "\n";
-  //    }
-  //  }
-  //
-  //  std::unordered_map<std::string, std::vector<FlexerInstance>>
-  //      fileToSubInstances = generateSubInstances(toBeSubstituted,
-  //      subtitutions);
-  //
-  //  std::cout <<
-  //  "=============================================================="
-  //            << "\n";
-  //  // print file to sub instances
-  //  for (const auto& [fileName, subInstances] : fileToSubInstances) {
-  //    std::cout << "File: " << fileName << "\n";
-  //    for (const auto& instance : subInstances) {
-  //      std::cout << "ID: " << instance.id << "\n";
-  //      std::cout << "Text: " << instance.text << "\n";
-  //    }
-  //  }
-  //  std::cout << "==========================================================="
-  //            << "\n";
-  //
-  //  std::cout <<
-  //  "---------------------------------------------------------------"
-  //               "-------"
-  //            << "\n";
-  //  for (const auto& [fileName, subInstances] : fileToSubInstances) {
-  //    std::cout << "File: " << fileName << "\n";
-  //    std::cout << subtituteFlexerInstances(fileName, subInstances) << "\n";
-  //  }
+  // without --include there is nothing to elaborate
+  if (clc::include.empty()) {
+    return 0;
+  }
+
+  // find all the files with the given extensions------------
+  hlog::setPhase("searching the sources");
+  std::vector<std::string> inFiles = findFiles();
+
+  hlog::setPhase("extracting the flexer instances");
+
+  const std::string indexPath =
+      (fs::path(clc::projectRoot) / ".flexer" / "index.bin").string();
+  auto instances = clc::noIndex ? extractFlexerInstances(inFiles)
+                                : extractFlexerInstances(inFiles, indexPath);
+  messageErrorIf(instances.empty(), "No flexer instances found");
+
+  if (!clc::compilationScript.empty() || !clc::runScript.empty()) {
+    hlog::setPhase("exploring the variants");
+    exploreVariants(instances);
+  }
 
   return 0;
 }
 
-void exceptionHandler() {
-  hlog::dumpErrorToFile("Exception received", errno, -1, true);
-  exit(EXIT_FAILURE);
+/// set by SIGINT, polled by the scheduler
+static std::atomic<bool> interrupted{false};
+
+static void interruptHandler(int) { interrupted.store(true); }
+
+/// @brief results.jsonl record of a variant: its parameters and the
+/// outcome and resources of each stage
+static std::string resultRecord(const ParameterSweep& sweep,
+                                const VariantResult& result) {
+  std::string record =
+      "{\"time\":" + std::to_string(std::time(nullptr)) +
+      ",\"variant\":" + std::to_string(result.variant) + ",\"params\":{";
+  Variant variant = sweep.space().at(result.variant);
+  const auto& regions = sweep.space().regions();
+  for (size_t i = 0; i < regions.size(); i++) {
+    record += i ? "," : "";
+    hlog::appendJsonString(record, regions[i].id);
+    record += ":";
+    hlog::appendJsonString(record, std::string(variant.textOf(i)));
+  }
+  record += std::string("},\"success\":") +
+            (result.success() ? "true" : "false") + ",\"cancelled\":" +
+            (result.cancelled ? "true" : "false");
+  if (result.compiled) {
+    record += ",\"compile\":" + result.compile.toJson();
+  }
+  if (result.ran) {
+    record += ",\"run\":" + result.run.toJson();
+    record += ",\"measurement\":{\"metric\":\"" + clc::metric +
+              "\",\"samples\":[";
+    for (size_t i = 0; i < result.samples.size(); i++) {
+      char sample[32];
+      snprintf(sample, sizeof(sample), "%s%.9g", i ? "," : "",
+               result.samples[i]);
+      record += sample;
+    }
+    record += "],\"stats\":" + result.stats.toJson() + "}";
+  }
+  return record + "}";
 }
 
-void handleErrors() {
-  pid_t pid = fork();
+void exploreVariants(const std::vector<FlexerInstance>& instances) {
+  ParameterSweep sweep(instances, clc::params);
+  const std::string projectRoot = fs::absolute(clc::projectRoot).string();
+  messageInfo("Exploring " + std::to_string(sweep.space().size()) +
+              " variants, writing " + std::to_string(sweep.files().size()) +
+              " files per variant");
 
-  if (pid == -1) {
-    messageError("Fork failed");
-    exit(EXIT_FAILURE);
+  SchedulerOptions options;
+  options.compilationScript = clc::compilationScript;
+  options.runScript = clc::runScript;
+  options.compileSlots = clc::compileSlots ? clc::compileSlots : clc::jobs;
+  options.runSlots = clc::runSlots;
+  options.queueSize = clc::queueSize;
+  options.compileTimeout = std::chrono::seconds(clc::compileTimeout);
+  options.runTimeout = std::chrono::seconds(clc::runTimeout);
+  if (clc::pinning) {
+    CpuAllocator cpus(CpuAllocator::readTopology(), options.runSlots,
+                      clc::coresPerRun, clc::reservedCores);
+    messageInfo("CPU allocation: " + cpus.describe());
+    options.compileCpus = cpus.compileSet();
+    options.runCpus = cpus.runSets();
+    if (!cpus.pinned()) {
+      // the runs share the cores left by the reservation
+      options.runCpus.assign(options.runSlots, cpus.compileSet());
+    }
+  }
+  options.metric = parseMetric(clc::metric);
+  options.repetitions.minRuns = clc::minRuns;
+  options.repetitions.maxRuns = clc::maxRuns;
+  options.repetitions.targetWidth = clc::targetWidth;
+  options.workspaceRoot =
+      (fs::path(projectRoot) / ".flexer" / "workspaces").string();
+  options.cancelRequested = &interrupted;
+  progresscpp::ParallelProgressBar progress;
+  if (!clc::psilent) {
+    options.progress = &progress;
   }
 
-  if (pid == 0) {
-    // handle catchable errors
-    std::set_terminate(exceptionHandler);
-    return;
-  } else {
-    // handle uncatchable errors
-    int status;
-    waitpid(pid, &status, 0);
-
-    if (WIFSIGNALED(status)) {
-      // abnormal termination with a signal
-      hlog::dumpErrorToFile("Abnormal termination with a signal",
-                            WIFEXITED(status) ? WEXITSTATUS(status) : -1,
-                            WTERMSIG(status));
-      std::cerr << "Abnormal termination with signal " << WTERMSIG(status)
-                << "\n";
-      exit(WTERMSIG(status));
-    } else if (WIFEXITED(status)) {
-      // normal exit
-      exit(WEXITSTATUS(status));
+  const std::string resultsPath =
+      clc::results.empty()
+          ? (fs::path(projectRoot) / ".flexer" / "results.jsonl").string()
+          : clc::results;
+  fs::create_directories(fs::path(resultsPath).parent_path());
+  hlog::JsonlSink results(resultsPath);
+
+  // the workspaces are brought up to date with the project the first time
+  // they are used, then only the files of the variants change
+  std::unordered_set<std::string> variantFiles;
+  for (const auto& [fileName, fileInstances] : sweep.files()) {
+    variantFiles.insert(fs::relative(fileName, projectRoot).string());
+  }
+  std::mutex syncGuard;
+  std::unordered_set<std::string> synced;
+
+  // the compilation script compiles through flexer-cc, built next to flexer
+  std::vector<std::string> cacheEnv;
+  std::unique_ptr<CompileCache> cache;
+  CacheStats cacheBefore;
+  if (clc::compileCache) {
+    std::error_code ec;
+    auto wrapper = fs::read_symlink("/proc/self/exe", ec).parent_path() /
+                   "flexer-cc";
+    if (ec || !fs::exists(wrapper)) {
+      messageWarning("flexer-cc not found next to flexer, compilations are "
+                     "not cached");
     } else {
-      // abnormal exit
-      hlog::dumpErrorToFile("Abnormal termination");
-      std::cerr << "Abnormal termination with status " << WEXITSTATUS(status)
-                << "\n";
-      exit(WEXITSTATUS(status));
+      const std::string dir =
+          clc::cacheDir.empty()
+              ? (fs::path(projectRoot) / ".flexer" / "cache").string()
+              : fs::absolute(clc::cacheDir).string();
+      cacheEnv = {"FLEXER_CC=" + wrapper.string(), "FLEXER_CACHE_DIR=" + dir,
+                  "FLEXER_CACHE_SIZE=" + std::to_string(clc::cacheSize)};
+      cache = std::make_unique<CompileCache>(
+          dir, uint64_t(clc::cacheSize) * 1024 * 1024);
+      cacheBefore = cache->stats();
     }
   }
 
-  exit(0);
+  auto previous = std::signal(SIGINT, interruptHandler);
+
+  size_t succeeded = 0, failed = 0, cancelled = 0;
+  VariantScheduler scheduler(options);
+  scheduler.run(
+      sweep.space().size(),
+      [&](uint64_t variant, const std::string& workspace) {
+        bool firstUse;
+        {
+          std::lock_guard<std::mutex> lock{syncGuard};
+          firstUse = synced.insert(workspace).second;
+        }
+        std::string detail = "variant " + std::to_string(variant);
+        if (firstUse) {
+          TraceScope trace("sync workspace", detail);
+          size_t copied =
+              syncTree(projectRoot, workspace, clc::exclude, variantFiles);
+          messageInfo("Workspace " + workspace + ": " +
+                      std::to_string(copied) + " files updated");
+        }
+        {
+          TraceScope trace("materialize", detail);
+          sweep.materialize(variant, projectRoot, workspace);
+        }
+        auto env = sweep.environment(variant);
+        env.push_back("FLEXER_PROJECT_ROOT=" + projectRoot);
+        env.insert(env.end(), cacheEnv.begin(), cacheEnv.end());
+        return env;
+      },
+      [&](VariantResult&& result) {
+        std::string name = "Variant " + std::to_string(result.variant);
+        results.append(resultRecord(sweep, result));
+        if (result.cancelled) {
+          cancelled++;
+        } else if (result.success()) {
+          succeeded++;
+          const ProcessResult& last = result.ran ? result.run : result.compile;
+          std::string summary = name + ": " + last.describe() + ", " +
+                                std::to_string(last.wallTime.count() / 1000000) +
+                                " ms, " +
+                                std::to_string(last.usage.maxRss / 1024) +
+                                " MiB peak";
+          const auto& stats = result.stats;
+          if (stats.count > 0) {
+            char measurement[160];
+            snprintf(measurement, sizeof(measurement),
+                     "; %s median %.6g, MAD %.3g, CI [%.6g, %.6g] over %zu "
+                     "runs%s",
+                     clc::metric.c_str(), stats.median, stats.mad,
+                     stats.ciLow, stats.ciHigh, stats.count,
+                     stats.converged ? "" : " (not converged)");
+            summary += measurement;
+          } else if (result.ran) {
+            summary += "; no " + clc::metric + " value";
+          }
+          messageInfo(summary);
+        } else {
+          failed++;
+          const ProcessResult& stage =
+              result.compiled && !result.compile.success() ? result.compile
+                                                           : result.run;
+          messageWarning(name + " failed: " + stage.describe() + "\n" +
+                         stage.err);
+        }
+      });
+
+  std::signal(SIGINT, previous);
+  results.flush();
+  messageInfo("Results written to " + resultsPath);
+  if (cache) {
+    CacheStats after = cache->stats();
+    CacheStats session;
+    session.hits = after.hits - cacheBefore.hits;
+    session.misses = after.misses - cacheBefore.misses;
+    session.uncacheable = after.uncacheable - cacheBefore.uncacheable;
+    char hitRate[16];
+    snprintf(hitRate, sizeof(hitRate), "%.1f%%", session.hitRate() * 100);
+    messageInfo("Compile cache: " + std::to_string(session.hits) +
+                " hits, " + std::to_string(session.misses) + " misses (" +
+                hitRate + " hit rate), " +
+                std::to_string(session.uncacheable) + " uncacheable, " +
+                std::to_string(after.bytes / (1024 * 1024)) + " MiB stored");
+  }
+  messageInfo("Variants: " + std::to_string(succeeded) + " succeeded, " +
+              std::to_string(failed) + " failed, " +
+              std::to_string(cancelled) + " cancelled");
+}
+
+void exceptionHandler() {
+  hlog::dumpErrorToFile("Exception received", errno, -1, true);
+  exit(EXIT_FAILURE);
+}
+
+void reportProfile() {
+  if (clc::profile) {
+    Profiler::report(std::cout);
+  }
+  if (!clc::profileJson.empty()) {
+    Profiler::exportJson(clc::profileJson);
+  }
+}
+
+void writeTrace() { Tracer::write(clc::trace); }
+
+void handleErrors() {
+  // handle uncatchable errors
+  hlog::installCrashHandler();
+  // handle catchable errors
+  std::set_terminate(exceptionHandler);
 }
 
 void parseCommandLineArguments(int argc, char* args[]) {
@@ -232,6 +398,141 @@ void parseCommandLineArguments(int argc, char* args[]) {
   if (result.count("server")) {
     clc::server = true;
   }
+  if (result.count("jobs")) {
+    clc::jobs = result["jobs"].as<size_t>();
+    messageErrorIf(clc::jobs == 0, "--jobs must be greater than 0");
+  }
+  if (result.count("exclude")) {
+    auto exclude = result["exclude"].as<std::vector<std::string>>();
+    clc::exclude.insert(clc::exclude.end(), exclude.begin(), exclude.end());
+  }
+  if (result.count("gitignore")) {
+    clc::gitignore = true;
+  }
+  if (result.count("no-index")) {
+    clc::noIndex = true;
+  }
+  if (result.count("async-log")) {
+    clc::asyncLog = true;
+  }
+  if (result.count("profile")) {
+    clc::profile = true;
+  }
+  if (result.count("profile-json")) {
+    clc::profileJson = result["profile-json"].as<std::string>();
+  }
+  if (result.count("trace")) {
+    clc::trace = result["trace"].as<std::string>();
+  }
+  if (result.count("progress-fd")) {
+    clc::progressFd = result["progress-fd"].as<int>();
+    messageErrorIf(clc::progressFd < 0 || fcntl(clc::progressFd, F_GETFD) < 0,
+                   "Invalid --progress-fd: " +
+                       std::to_string(clc::progressFd));
+  }
+  if (result.count("log-level")) {
+    auto level = result["log-level"].as<std::string>();
+    if (level == "info") {
+      clc::logLevel = FLEXER_LOG_LEVEL_INFO;
+    } else if (level == "warning") {
+      clc::logLevel = FLEXER_LOG_LEVEL_WARNING;
+    } else if (level == "error") {
+      clc::logLevel = FLEXER_LOG_LEVEL_ERROR;
+    } else {
+      messageError("Unknown log level: " + level +
+                   " (expected info, warning or error)");
+    }
+  }
+  if (result.count("compilation-script")) {
+    clc::compilationScript = result["compilation-script"].as<std::string>();
+  }
+  if (result.count("run-script")) {
+    clc::runScript = result["run-script"].as<std::string>();
+  }
+  if (result.count("compile-slots")) {
+    clc::compileSlots = result["compile-slots"].as<size_t>();
+    messageErrorIf(clc::compileSlots == 0,
+                   "--compile-slots must be greater than 0");
+  }
+  if (result.count("run-slots")) {
+    clc::runSlots = result["run-slots"].as<size_t>();
+    messageErrorIf(clc::runSlots == 0, "--run-slots must be greater than 0");
+  }
+  if (result.count("queue-size")) {
+    clc::queueSize = result["queue-size"].as<size_t>();
+  }
+  if (result.count("compile-timeout")) {
+    clc::compileTimeout = result["compile-timeout"].as<size_t>();
+  }
+  if (result.count("run-timeout")) {
+    clc::runTimeout = result["run-timeout"].as<size_t>();
+  }
+  if (result.count("reserved-cores")) {
+    for (const auto& item :
+         result["reserved-cores"].as<std::vector<std::string>>()) {
+      auto cpus = parseCpuList(item);
+      clc::reservedCores.insert(clc::reservedCores.end(), cpus.begin(),
+                                cpus.end());
+    }
+  }
+  if (result.count("cores-per-run")) {
+    clc::coresPerRun = result["cores-per-run"].as<size_t>();
+    messageErrorIf(clc::coresPerRun == 0,
+                   "--cores-per-run must be greater than 0");
+  }
+  if (result.count("no-pinning")) {
+    clc::pinning = false;
+  }
+  if (result.count("metric")) {
+    clc::metric = result["metric"].as<std::string>();
+    parseMetric(clc::metric);
+  }
+  if (result.count("min-runs")) {
+    clc::minRuns = result["min-runs"].as<size_t>();
+    messageErrorIf(clc::minRuns == 0, "--min-runs must be greater than 0");
+  }
+  if (result.count("max-runs")) {
+    clc::maxRuns = result["max-runs"].as<size_t>();
+    messageErrorIf(clc::maxRuns == 0, "--max-runs must be greater than 0");
+  }
+  clc::minRuns = std::min(clc::minRuns, clc::maxRuns);
+  if (result.count("target-width")) {
+    clc::targetWidth = result["target-width"].as<double>();
+    messageErrorIf(!(clc::targetWidth > 0),
+                   "--target-width must be greater than 0");
+  }
+  if (result.count("cache-dir")) {
+    clc::cacheDir = result["cache-dir"].as<std::string>();
+  }
+  if (result.count("cache-size")) {
+    clc::cacheSize = result["cache-size"].as<size_t>();
+    messageErrorIf(clc::cacheSize == 0, "--cache-size must be greater than 0");
+  }
+  if (result.count("no-cache")) {
+    clc::compileCache = false;
+  }
+  if (result.count("results")) {
+    clc::results = result["results"].as<std::string>();
+  }
+  if (result.count("param")) {
+    // the values are split on commas too: an item without '=' is one more
+    // value of the previous parameter
+    for (const auto& item : result["param"].as<std::vector<std::string>>()) {
+      auto equal = item.find('=');
+      if (equal == std::string::npos) {
+        messageErrorIf(clc::params.empty(), "Invalid --param: " + item +
+                                                " (expected NAME=v1,v2)");
+        clc::params.back().second.push_back(item);
+        continue;
+      }
+      auto name = item.substr(0, equal);
+      messageErrorIf(name.empty(), "Invalid --param: " + item);
+      for (const auto& [other, values] : clc::params) {
+        messageErrorIf(other == name, "Parameter given twice: " + name);
+      }
+      clc::params.push_back({name, {item.substr(equal + 1)}});
+    }
+  }
   messageErrorIf(clc::client && clc::server,
                  "Flexer cannot be client and server at the same time");
 }
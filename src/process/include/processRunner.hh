@@ -0,0 +1,155 @@
+#pragma once
+
+#include <sys/resource.h>
+#include <sys/types.h>
+
+#include <chrono>
+#include <condition_variable>
+#include <cstdint>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <unordered_map>
+#include <vector>
+
+namespace flexer {
+
+/// @brief Description of a child process.
+struct ProcessSpec {
+  /// @brief Program and arguments; the program is searched in PATH.
+  std::vector<std::string> argv;
+  /// @brief Variables added to the environment of flexer, as NAME=value.
+  std::vector<std::string> env;
+  /// @brief Working directory, the one of flexer if empty.
+  std::string workingDirectory;
+  /// @brief CPUs the process and its children may run on, set before
+  /// exec; those of flexer if empty.
+  std::vector<int> cpus;
+  /// @brief Wall-clock limit, none if zero. Once expired, the process
+  /// group gets SIGTERM, then SIGKILL after killGrace.
+  std::chrono::milliseconds timeout{0};
+  std::chrono::milliseconds killGrace{2000};
+  /// @brief Bytes of stdout and of stderr kept, the rest is discarded.
+  size_t maxOutput = 16 * 1024 * 1024;
+  /// @brief Name of the track of the process in the trace, argv[0] if
+  /// empty.
+  std::string traceName;
+};
+
+/// @brief Resources used by a child process, from the rusage of wait4.
+/// @details The counters include the descendants the process waited for,
+/// such as the compilers started by a build script; maxRss is the peak of
+/// the largest of them, not their sum.
+struct ResourceUsage {
+  std::chrono::microseconds userTime{0};
+  std::chrono::microseconds systemTime{0};
+  /// @brief Peak resident set size, in KiB.
+  int64_t maxRss = 0;
+  /// @brief Page faults served without and with I/O.
+  int64_t minorFaults = 0;
+  int64_t majorFaults = 0;
+  /// @brief Context switches while waiting for a resource, and because the
+  /// time slice expired or a higher priority process became runnable.
+  int64_t voluntarySwitches = 0;
+  int64_t involuntarySwitches = 0;
+
+  static ResourceUsage fromRusage(const struct rusage &usage);
+
+  /// @brief JSON object of the counters, times in seconds.
+  std::string toJson() const;
+};
+
+/// @brief Outcome of a child process.
+struct ProcessResult {
+  pid_t pid = -1;
+  /// @brief False if the process could not be started, see spawnError.
+  bool spawned = false;
+  int spawnError = 0;
+  /// @brief Exit status, -1 if the process was killed by a signal.
+  int exitCode = -1;
+  /// @brief Signal that killed the process, 0 if it exited.
+  int signal = 0;
+  /// @brief True if the process was killed because of its timeout.
+  bool timedOut = false;
+  /// @brief True if the process was killed by cancel.
+  bool cancelled = false;
+  std::string out;
+  std::string err;
+  /// @brief True if out or err were cut at maxOutput.
+  bool truncated = false;
+  std::chrono::nanoseconds wallTime{0};
+  ResourceUsage usage;
+
+  bool success() const { return spawned && exitCode == 0; }
+
+  /// @brief Human readable outcome, such as "exit 1" or "killed by
+  /// SIGKILL (timeout)".
+  std::string describe() const;
+
+  /// @brief JSON object of the outcome and of the resources used, without
+  /// the output.
+  std::string toJson() const;
+};
+
+/// @brief Runs child processes without a thread per child.
+/// @details Processes are started with posix_spawn in their own process
+/// group. A single event loop thread waits with epoll on the stdout and
+/// stderr pipes of all the children and on their pidfds, enforces the
+/// timeouts and reaps them with wait4. When pidfds are not supported the
+/// children are polled.
+class ProcessRunner {
+public:
+  using Id = uint64_t;
+  /// @brief Called from the event loop thread: must not block.
+  using Callback = std::function<void(ProcessResult &&)>;
+
+  ProcessRunner();
+  /// @brief Kills the children still running and waits for them.
+  ~ProcessRunner();
+
+  ProcessRunner(const ProcessRunner &) = delete;
+  ProcessRunner &operator=(const ProcessRunner &) = delete;
+
+  /// @brief Starts a process; onExit receives its result. If the process
+  /// cannot be started, onExit is called before returning.
+  Id start(const ProcessSpec &spec, Callback onExit);
+
+  /// @brief Starts a process and waits for its result.
+  ProcessResult run(const ProcessSpec &spec);
+
+  /// @brief Terminates a process as if its timeout expired.
+  void cancel(Id id);
+
+  /// @brief Terminates all the running processes.
+  void cancelAll();
+
+  /// @brief Number of processes not reaped yet.
+  size_t running() const;
+
+private:
+  struct Child;
+
+  void loop();
+  void wake();
+  void addChild(std::unique_ptr<Child> child);
+  void readOutput(Child &child, int fd);
+  void reap(Child &child);
+  void finish(Id id);
+  std::chrono::steady_clock::time_point checkDeadlines();
+
+  int _epoll = -1;
+  int _wakeFd = -1;
+  bool _pidfdSupported = true;
+
+  mutable std::mutex _guard;
+  std::unordered_map<Id, std::unique_ptr<Child>> _children;
+  std::vector<std::unique_ptr<Child>> _pending;
+  std::vector<Id> _toCancel;
+  Id _nextId = 1;
+  bool _stopping = false;
+  std::thread _loop;
+};
+
+} // namespace flexer
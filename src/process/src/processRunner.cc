@@ -0,0 +1,574 @@
+#include "processRunner.hh"
+
+#include <errno.h>
+#include <fcntl.h>
+#include <sched.h>
+#include <signal.h>
+#include <spawn.h>
+#include <string.h>
+#include <sys/epoll.h>
+#include <sys/eventfd.h>
+#include <sys/syscall.h>
+#include <sys/wait.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <cstdio>
+#include <future>
+
+#include "crashHandler.hh"
+#include "jsonlSink.hh"
+#include "message.hh"
+#include "trace.hh"
+
+extern char **environ;
+
+namespace flexer {
+
+namespace {
+
+enum FdKind : uint64_t { outFd = 0, errFd = 1, exitFd = 2 };
+
+uint64_t epollKey(uint64_t id, FdKind kind) { return id << 2 | kind; }
+
+void setNonBlocking(int fd) {
+  fcntl(fd, F_SETFL, fcntl(fd, F_GETFL) | O_NONBLOCK);
+}
+
+int openPidfd(pid_t pid) {
+#ifdef SYS_pidfd_open
+  return static_cast<int>(syscall(SYS_pidfd_open, pid, 0));
+#else
+  (void)pid;
+  errno = ENOSYS;
+  return -1;
+#endif
+}
+
+/// environment of flexer with the variables of extra added or replaced
+std::vector<std::string> mergeEnvironment(
+    const std::vector<std::string> &extra) {
+  std::vector<std::string> env;
+  auto overridden = [&extra](const char *var) {
+    for (const auto &e : extra) {
+      size_t nameLength = e.find('=');
+      if (strncmp(var, e.c_str(), nameLength) == 0 &&
+          var[nameLength] == '=') {
+        return true;
+      }
+    }
+    return false;
+  };
+  for (char **var = environ; var && *var; var++) {
+    if (!overridden(*var)) {
+      env.emplace_back(*var);
+    }
+  }
+  env.insert(env.end(), extra.begin(), extra.end());
+  return env;
+}
+
+std::vector<char *> toArgv(std::vector<std::string> &strings) {
+  std::vector<char *> argv;
+  argv.reserve(strings.size() + 1);
+  for (auto &s : strings) {
+    argv.push_back(s.data());
+  }
+  argv.push_back(nullptr);
+  return argv;
+}
+
+} // namespace
+
+struct ProcessRunner::Child {
+  Id id;
+  pid_t pid;
+  int pidfd = -1;
+  int out = -1;
+  int err = -1;
+  size_t maxOutput;
+  std::chrono::milliseconds killGrace;
+  std::string traceName;
+  Callback onExit;
+  ProcessResult result;
+
+  std::chrono::steady_clock::time_point start;
+  uint64_t traceStart;
+  /// SIGTERM is sent at deadline, SIGKILL at killDeadline
+  std::chrono::steady_clock::time_point deadline;
+  std::chrono::steady_clock::time_point killDeadline;
+  int signalsSent = 0;
+  bool exited = false;
+};
+
+ResourceUsage ResourceUsage::fromRusage(const struct rusage &usage) {
+  auto microseconds = [](const struct timeval &time) {
+    return std::chrono::microseconds(int64_t(time.tv_sec) * 1000000 +
+                                     time.tv_usec);
+  };
+  ResourceUsage result;
+  result.userTime = microseconds(usage.ru_utime);
+  result.systemTime = microseconds(usage.ru_stime);
+  result.maxRss = usage.ru_maxrss;
+  result.minorFaults = usage.ru_minflt;
+  result.majorFaults = usage.ru_majflt;
+  result.voluntarySwitches = usage.ru_nvcsw;
+  result.involuntarySwitches = usage.ru_nivcsw;
+  return result;
+}
+
+std::string ResourceUsage::toJson() const {
+  char buffer[256];
+  snprintf(buffer, sizeof(buffer),
+           "{\"user\":%.6f,\"system\":%.6f,\"maxRssKiB\":%lld,"
+           "\"minorFaults\":%lld,\"majorFaults\":%lld,"
+           "\"voluntarySwitches\":%lld,\"involuntarySwitches\":%lld}",
+           userTime.count() / 1e6, systemTime.count() / 1e6,
+           (long long)maxRss, (long long)minorFaults,
+           (long long)majorFaults, (long long)voluntarySwitches,
+           (long long)involuntarySwitches);
+  return buffer;
+}
+
+std::string ProcessResult::toJson() const {
+  std::string json = "{\"outcome\":";
+  hlog::appendJsonString(json, describe());
+  json += ",\"exitCode\":" + std::to_string(exitCode) +
+          ",\"signal\":" + std::to_string(signal) +
+          ",\"timedOut\":" + (timedOut ? "true" : "false");
+  char wall[32];
+  snprintf(wall, sizeof(wall), "%.6f", wallTime.count() / 1e9);
+  json += std::string(",\"wall\":") + wall;
+  json += ",\"usage\":" + usage.toJson() + "}";
+  return json;
+}
+
+std::string ProcessResult::describe() const {
+  if (!spawned) {
+    return std::string("not started (") + strerror(spawnError) + ")";
+  }
+  std::string outcome =
+      signal == 0 ? "exit " + std::to_string(exitCode)
+                  : std::string("killed by SIG") +
+                        (hlog::signalName(signal) ? hlog::signalName(signal)
+                                                   : std::to_string(signal));
+  if (timedOut) {
+    outcome += " (timeout)";
+  } else if (cancelled) {
+    outcome += " (cancelled)";
+  }
+  return outcome;
+}
+
+ProcessRunner::ProcessRunner() {
+  _epoll = epoll_create1(EPOLL_CLOEXEC);
+  messageErrorIf(_epoll < 0, std::string("epoll_create1 failed: ") +
+                                 strerror(errno));
+  _wakeFd = eventfd(0, EFD_CLOEXEC | EFD_NONBLOCK);
+  messageErrorIf(_wakeFd < 0,
+                 std::string("eventfd failed: ") + strerror(errno));
+  struct epoll_event event = {};
+  event.events = EPOLLIN;
+  event.data.u64 = epollKey(0, exitFd);
+  epoll_ctl(_epoll, EPOLL_CTL_ADD, _wakeFd, &event);
+
+  _loop = std::thread([this] {
+    Tracer::setThreadName("process runner");
+    loop();
+  });
+}
+
+ProcessRunner::~ProcessRunner() {
+  {
+    std::lock_guard<std::mutex> lock{_guard};
+    _stopping = true;
+  }
+  wake();
+  _loop.join();
+  close(_wakeFd);
+  close(_epoll);
+}
+
+ProcessRunner::Id ProcessRunner::start(const ProcessSpec &spec,
+                                       Callback onExit) {
+  messageErrorIf(spec.argv.empty(), "No program to run");
+
+  auto child = std::make_unique<Child>();
+  child->maxOutput = spec.maxOutput;
+  child->killGrace = spec.killGrace;
+  child->traceName =
+      spec.traceName.empty() ? spec.argv[0] : spec.traceName;
+  child->onExit = std::move(onExit);
+
+  int outPipe[2];
+  int errPipe[2];
+  if (pipe2(outPipe, O_CLOEXEC) != 0) {
+    child->result.spawnError = errno;
+    child->onExit(std::move(child->result));
+    return 0;
+  }
+  if (pipe2(errPipe, O_CLOEXEC) != 0) {
+    child->result.spawnError = errno;
+    close(outPipe[0]);
+    close(outPipe[1]);
+    child->onExit(std::move(child->result));
+    return 0;
+  }
+
+  posix_spawn_file_actions_t actions;
+  posix_spawn_file_actions_init(&actions);
+  posix_spawn_file_actions_addopen(&actions, STDIN_FILENO, "/dev/null",
+                                   O_RDONLY, 0);
+  posix_spawn_file_actions_adddup2(&actions, outPipe[1], STDOUT_FILENO);
+  posix_spawn_file_actions_adddup2(&actions, errPipe[1], STDERR_FILENO);
+  if (!spec.workingDirectory.empty()) {
+    posix_spawn_file_actions_addchdir_np(&actions,
+                                         spec.workingDirectory.c_str());
+  }
+
+  // own process group, so that the timeout kills the whole script; the
+  // signals ignored by flexer are not inherited
+  posix_spawnattr_t attributes;
+  posix_spawnattr_init(&attributes);
+  posix_spawnattr_setflags(&attributes, POSIX_SPAWN_SETPGROUP |
+                                            POSIX_SPAWN_SETSIGMASK |
+                                            POSIX_SPAWN_SETSIGDEF);
+  posix_spawnattr_setpgroup(&attributes, 0);
+  sigset_t signals;
+  sigemptyset(&signals);
+  posix_spawnattr_setsigmask(&attributes, &signals);
+  for (int s : {SIGPIPE, SIGINT, SIGQUIT, SIGHUP, SIGTERM, SIGCHLD}) {
+    sigaddset(&signals, s);
+  }
+  posix_spawnattr_setsigdefault(&attributes, &signals);
+
+  std::vector<std::string> args = spec.argv;
+  std::vector<std::string> env = mergeEnvironment(spec.env);
+  std::vector<char *> argv = toArgv(args);
+  std::vector<char *> envp = toArgv(env);
+
+  // posix_spawn has no affinity attribute: the child inherits the one of
+  // the calling thread, which is set for the duration of the spawn
+  cpu_set_t previousCpus;
+  int error = 0;
+  if (!spec.cpus.empty()) {
+    cpu_set_t cpus;
+    CPU_ZERO(&cpus);
+    for (int cpu : spec.cpus) {
+      CPU_SET(cpu, &cpus);
+    }
+    if (sched_getaffinity(0, sizeof(previousCpus), &previousCpus) != 0 ||
+        sched_setaffinity(0, sizeof(cpus), &cpus) != 0) {
+      error = errno;
+    }
+  }
+
+  child->start = std::chrono::steady_clock::now();
+  child->traceStart = Tracer::now();
+  if (error == 0) {
+    error = posix_spawnp(&child->pid, argv[0], &actions, &attributes,
+                         argv.data(), envp.data());
+    if (!spec.cpus.empty()) {
+      sched_setaffinity(0, sizeof(previousCpus), &previousCpus);
+    }
+  }
+  posix_spawn_file_actions_destroy(&actions);
+  posix_spawnattr_destroy(&attributes);
+  close(outPipe[1]);
+  close(errPipe[1]);
+
+  if (error != 0) {
+    close(outPipe[0]);
+    close(errPipe[0]);
+    child->result.spawnError = error;
+    child->onExit(std::move(child->result));
+    return 0;
+  }
+
+  child->result.spawned = true;
+  child->result.pid = child->pid;
+  child->out = outPipe[0];
+  child->err = errPipe[0];
+  setNonBlocking(child->out);
+  setNonBlocking(child->err);
+  child->deadline = spec.timeout.count() > 0
+                        ? child->start + spec.timeout
+                        : std::chrono::steady_clock::time_point::max();
+  child->killDeadline = std::chrono::steady_clock::time_point::max();
+
+  Id id;
+  {
+    std::lock_guard<std::mutex> lock{_guard};
+    id = child->id = _nextId++;
+    _pending.push_back(std::move(child));
+  }
+  wake();
+  return id;
+}
+
+ProcessResult ProcessRunner::run(const ProcessSpec &spec) {
+  std::promise<ProcessResult> promise;
+  auto result = promise.get_future();
+  start(spec, [&promise](ProcessResult &&r) {
+    promise.set_value(std::move(r));
+  });
+  return result.get();
+}
+
+void ProcessRunner::cancel(Id id) {
+  {
+    std::lock_guard<std::mutex> lock{_guard};
+    _toCancel.push_back(id);
+  }
+  wake();
+}
+
+void ProcessRunner::cancelAll() {
+  {
+    std::lock_guard<std::mutex> lock{_guard};
+    for (const auto &[id, child] : _children) {
+      _toCancel.push_back(id);
+    }
+    for (const auto &child : _pending) {
+      _toCancel.push_back(child->id);
+    }
+  }
+  wake();
+}
+
+size_t ProcessRunner::running() const {
+  std::lock_guard<std::mutex> lock{_guard};
+  return _children.size() + _pending.size();
+}
+
+void ProcessRunner::wake() {
+  uint64_t one = 1;
+  ssize_t written = write(_wakeFd, &one, sizeof(one));
+  (void)written;
+}
+
+void ProcessRunner::addChild(std::unique_ptr<Child> child) {
+  struct epoll_event event = {};
+  event.events = EPOLLIN;
+  event.data.u64 = epollKey(child->id, outFd);
+  epoll_ctl(_epoll, EPOLL_CTL_ADD, child->out, &event);
+  event.data.u64 = epollKey(child->id, errFd);
+  epoll_ctl(_epoll, EPOLL_CTL_ADD, child->err, &event);
+
+  if (_pidfdSupported) {
+    child->pidfd = openPidfd(child->pid);
+    if (child->pidfd < 0) {
+      // old kernel: fall back to polling the children
+      _pidfdSupported = false;
+    } else {
+      event.data.u64 = epollKey(child->id, exitFd);
+      epoll_ctl(_epoll, EPOLL_CTL_ADD, child->pidfd, &event);
+    }
+  }
+
+  std::lock_guard<std::mutex> lock{_guard};
+  _children.emplace(child->id, std::move(child));
+}
+
+void ProcessRunner::readOutput(Child &child, int fd) {
+  std::string &output = fd == child.out ? child.result.out
+                                        : child.result.err;
+  char buffer[64 * 1024];
+  while (true) {
+    ssize_t n = read(fd, buffer, sizeof(buffer));
+    if (n > 0) {
+      size_t keep = std::min<size_t>(
+          n, child.maxOutput - std::min(child.maxOutput, output.size()));
+      output.append(buffer, keep);
+      child.result.truncated |= keep < static_cast<size_t>(n);
+      continue;
+    }
+    if (n < 0 && errno == EINTR) {
+      continue;
+    }
+    if (n < 0 && errno == EAGAIN) {
+      return;
+    }
+    // end of file or error: the pipe is done
+    epoll_ctl(_epoll, EPOLL_CTL_DEL, fd, nullptr);
+    close(fd);
+    (fd == child.out ? child.out : child.err) = -1;
+    return;
+  }
+}
+
+void ProcessRunner::reap(Child &child) {
+  int status;
+  struct rusage usage;
+  pid_t pid;
+  do {
+    pid = wait4(child.pid, &status, _pidfdSupported ? 0 : WNOHANG, &usage);
+  } while (pid < 0 && errno == EINTR);
+  if (pid <= 0) {
+    return;
+  }
+
+  child.exited = true;
+  child.result.usage = ResourceUsage::fromRusage(usage);
+  if (WIFEXITED(status)) {
+    child.result.exitCode = WEXITSTATUS(status);
+  } else if (WIFSIGNALED(status)) {
+    child.result.signal = WTERMSIG(status);
+  }
+
+  // what is left in the pipes; processes started by the child may keep
+  // them open, they are not waited for
+  for (int fd : {child.out, child.err}) {
+    if (fd >= 0) {
+      readOutput(child, fd);
+    }
+  }
+  for (int *fd : {&child.out, &child.err, &child.pidfd}) {
+    if (*fd >= 0) {
+      epoll_ctl(_epoll, EPOLL_CTL_DEL, *fd, nullptr);
+      close(*fd);
+      *fd = -1;
+    }
+  }
+}
+
+void ProcessRunner::finish(Id id) {
+  std::unique_ptr<Child> child;
+  {
+    std::lock_guard<std::mutex> lock{_guard};
+    auto it = _children.find(id);
+    child = std::move(it->second);
+    _children.erase(it);
+  }
+  child->result.wallTime = std::chrono::steady_clock::now() - child->start;
+  if (Tracer::enabled()) {
+    Tracer::recordProcess(child->traceName, child->pid, child->traceStart,
+                          Tracer::now(), child->result.describe());
+  }
+  child->onExit(std::move(child->result));
+}
+
+std::chrono::steady_clock::time_point ProcessRunner::checkDeadlines() {
+  auto now = std::chrono::steady_clock::now();
+  auto next = std::chrono::steady_clock::time_point::max();
+  for (auto &[id, child] : _children) {
+    if (child->exited) {
+      continue;
+    }
+    if (child->signalsSent == 0 && now >= child->deadline) {
+      child->result.timedOut = !child->result.cancelled;
+      kill(-child->pid, SIGTERM);
+      child->signalsSent = 1;
+      child->killDeadline = now + child->killGrace;
+    }
+    if (child->signalsSent == 1 && now >= child->killDeadline) {
+      kill(-child->pid, SIGKILL);
+      child->signalsSent = 2;
+    }
+    if (child->signalsSent == 0) {
+      next = std::min(next, child->deadline);
+    } else if (child->signalsSent == 1) {
+      next = std::min(next, child->killDeadline);
+    }
+  }
+  return next;
+}
+
+void ProcessRunner::loop() {
+  std::vector<struct epoll_event> events(64);
+  while (true) {
+    std::vector<std::unique_ptr<Child>> pending;
+    std::vector<Id> toCancel;
+    bool stopping;
+    {
+      std::lock_guard<std::mutex> lock{_guard};
+      pending.swap(_pending);
+      toCancel.swap(_toCancel);
+      stopping = _stopping;
+      if (stopping && pending.empty() && _children.empty()) {
+        break;
+      }
+    }
+    for (auto &child : pending) {
+      addChild(std::move(child));
+    }
+
+    auto now = std::chrono::steady_clock::now();
+    for (Id id : toCancel) {
+      auto it = _children.find(id);
+      if (it != _children.end() && it->second->signalsSent == 0) {
+        it->second->result.cancelled = true;
+        it->second->deadline = now;
+      }
+    }
+    if (stopping) {
+      // no grace when flexer itself is terminating
+      for (auto &[id, child] : _children) {
+        child->result.cancelled |= child->signalsSent == 0;
+        child->deadline = now;
+        child->killDeadline = now;
+        child->killGrace = std::chrono::milliseconds(0);
+      }
+    }
+
+    auto next = checkDeadlines();
+    int timeout = -1;
+    if (next != std::chrono::steady_clock::time_point::max()) {
+      auto wait = std::chrono::duration_cast<std::chrono::milliseconds>(
+                      next - std::chrono::steady_clock::now())
+                      .count();
+      timeout = static_cast<int>(std::max<int64_t>(wait + 1, 0));
+    }
+    if (!_pidfdSupported && !_children.empty()) {
+      timeout = timeout < 0 ? 10 : std::min(timeout, 10);
+    }
+
+    int n = epoll_wait(_epoll, events.data(),
+                       static_cast<int>(events.size()), timeout);
+    for (int i = 0; i < n; i++) {
+      uint64_t key = events[i].data.u64;
+      Id id = key >> 2;
+      if (id == 0) {
+        uint64_t count;
+        ssize_t r = read(_wakeFd, &count, sizeof(count));
+        (void)r;
+        continue;
+      }
+      auto it = _children.find(id);
+      if (it == _children.end()) {
+        continue;
+      }
+      Child &child = *it->second;
+      switch (static_cast<FdKind>(key & 3)) {
+      case outFd:
+        if (child.out >= 0) {
+          readOutput(child, child.out);
+        }
+        break;
+      case errFd:
+        if (child.err >= 0) {
+          readOutput(child, child.err);
+        }
+        break;
+      case exitFd:
+        reap(child);
+        break;
+      }
+    }
+
+    std::vector<Id> done;
+    for (auto &[id, child] : _children) {
+      if (!child->exited && !_pidfdSupported) {
+        reap(*child);
+      }
+      if (child->exited) {
+        done.push_back(id);
+      }
+    }
+    for (Id id : done) {
+      finish(id);
+    }
+  }
+}
+
+} // namespace flexer
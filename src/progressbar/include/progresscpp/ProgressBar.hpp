@@ -1,21 +1,88 @@
 #pragma once
 
 #include "globals.hh"
+#include "message.hh"
+#include <unistd.h>
+
 #include <algorithm>
+#include <atomic>
+#include <cerrno>
 #include <chrono>
+#include <condition_variable>
+#include <cstdint>
+#include <cstdio>
+#include <deque>
 #include <iostream>
+#include <memory>
 #include <mutex>
 #include <string>
+#include <thread>
+#include <tuple>
 #include <unordered_map>
 #include <utility>
 #include <vector>
 
 namespace progresscpp {
 
-inline void jumpBack(size_t times) {
+///append the escape codes moving the cursor up by times lines, clearing
+///them
+inline void jumpBack(std::string &out, size_t times) {
   for (size_t i = 0; i < times; i++) {
-    std::cout << "\033[A";
-    std::cout << "\33[2K";
+    out += "\033[A";
+    out += "\33[2K";
+  }
+}
+
+inline void jumpBack(size_t times) {
+  std::string out;
+  jumpBack(out, times);
+  std::cout << out;
+}
+
+///append the line of a progress bar to out
+inline void renderBar(std::string &out, uint64_t ticks,
+                      uint64_t total_ticks, unsigned int bar_width,
+                      std::chrono::steady_clock::duration elapsed,
+                      char complete_char = '=',
+                      char incomplete_char = ' ') {
+  float progress = total_ticks == 0 ? 1.f : (float)ticks / total_ticks;
+  size_t pos = (int)(bar_width * progress);
+  auto time_elapsed =
+      std::chrono::duration_cast<std::chrono::milliseconds>(elapsed)
+          .count();
+
+  out += "[";
+  for (size_t i = 0; i < bar_width; ++i) {
+    if (i < pos)
+      out += complete_char;
+    else if (i == pos)
+      out += ">";
+    else
+      out += incomplete_char;
+  }
+  char tail[64];
+  snprintf(tail, sizeof(tail), "] %d%% %gs\r\n", int(progress * 100.0),
+           float(time_elapsed) / 1000.0);
+  out += tail;
+}
+
+///write the whole buffer to fd (stdout by default) with as few system
+///calls as possible, after what is pending in std::cout
+inline void writeToOut(const std::string &out,
+                       int fd = STDOUT_FILENO) {
+  std::cout.flush();
+  const char *data = out.data();
+  size_t left = out.size();
+  while (left > 0) {
+    ssize_t written = ::write(fd, data, left);
+    if (written < 0) {
+      if (errno == EINTR) {
+        continue;
+      }
+      return;
+    }
+    data += written;
+    left -= written;
   }
 }
 
@@ -76,156 +143,449 @@ public:
   bool isFinished() { return _finished; }
 
   void display() const {
-    float progress = (float)ticks / total_ticks;
-    size_t pos = (int)(bar_width * progress);
-
-    std::chrono::steady_clock::time_point now =
-        std::chrono::steady_clock::now();
-    auto time_elapsed =
-        std::chrono::duration_cast<std::chrono::milliseconds>(
-            now - start_time)
-            .count();
-
-    std::cout << "[";
-
-    for (size_t i = 0; i < bar_width; ++i) {
-      if (i < pos)
-        std::cout << complete_char;
-      else if (i == pos)
-        std::cout << ">";
-      else
-        std::cout << incomplete_char;
-    }
-    std::cout << "] " << int(progress * 100.0) << "% "
-              << float(time_elapsed) / 1000.0 << "s\r";
-    std::cout << std::endl;
+    std::string out;
+    renderBar(out, ticks, total_ticks, bar_width,
+              std::chrono::steady_clock::now() - start_time,
+              complete_char, incomplete_char);
+    writeToOut(out);
   }
 
   void done() { _finished = true; }
 };
 
+///append str to out as a JSON string literal
+inline void appendJsonString(std::string &out, const std::string &str) {
+  out += '"';
+  for (char c : str) {
+    if (c == '"' || c == '\\') {
+      out += '\\';
+      out += c;
+    } else if (static_cast<unsigned char>(c) < 0x20) {
+      char escaped[8];
+      snprintf(escaped, sizeof(escaped), "\\u%04x", c);
+      out += escaped;
+    } else {
+      out += c;
+    }
+  }
+  out += '"';
+}
+
 ///class to manage multiple instances of a progress bar
+///
+///When stdout is not a terminal, or --progress-fd is given, the frames
+///are JSON lines instead of bars: one record per instance with its
+///progress, throughput and ETA, plus one record with the gauges, at
+///most once per second.
+///
+///The ticks and the counters of the instances live in a table of
+///atomic slots addressed by id: increment and incrementCounter never
+///lock and cost an atomic add. A render thread snapshots the instances
+///at a fixed frame rate and prints each frame with a single write.
+///Adding, terminating and renaming instances are rare and take a mutex.
 class ParallelProgressBar {
 public:
-  virtual ~ParallelProgressBar() {}
+  ///@param capacity maximum number of instances alive at once
+  explicit ParallelProgressBar(size_t capacity = 1024) {
+    size_t size = 1;
+    // keep the table at most half full, probes stay short
+    while (size < capacity * 2) {
+      size <<= 1;
+    }
+    _slots = std::make_unique<Slot[]>(size);
+    _mask = size - 1;
+    _capacity = capacity;
+
+    if (clc::progressFd >= 0) {
+      _jsonl = true;
+      _fd = clc::progressFd;
+    } else if (!isatty(STDOUT_FILENO)) {
+      //no cursor movements in logs and pipes
+      _jsonl = true;
+    }
+  }
+
+  virtual ~ParallelProgressBar() { stopRenderer(); }
+
+  ParallelProgressBar(const ParallelProgressBar &) = delete;
+  ParallelProgressBar &
+  operator=(const ParallelProgressBar &) = delete;
+
   ///add a new instance of the parallel progress bar
   void addInstance(size_t id, const std::string &message,
                    unsigned int total, unsigned int width) {
     std::lock_guard<std::mutex> lock{_pbGuard};
-    //add the instance
-    _instances.insert({{id, ProgressBar(total, width, message)}});
-
-    //print unless progress bars are disables
-    if (!clc::psilent) {
-      std::cout << _instances.at(id).getMessage() << "\n";
-      _instances.at(id).display();
+    messageErrorIf(id >= tombstone, "Invalid progress bar id");
+    messageErrorIf(_instances.count(id),
+                   "Progress bar " + std::to_string(id) +
+                       " already exists");
+    messageErrorIf(_instances.size() == _capacity,
+                   "Too many progress bars");
+
+    //claim a slot, reset before publishing its key
+    size_t i = hash(id);
+    while (true) {
+      size_t key = _slots[i].key.load(std::memory_order_relaxed);
+      if (key == empty || key == tombstone) {
+        break;
+      }
+      i = (i + 1) & _mask;
     }
+    Slot &slot = _slots[i];
+    slot.ticks.store(0, std::memory_order_relaxed);
+    slot.counter.store(0, std::memory_order_relaxed);
+    slot.counterEnabled.store(false, std::memory_order_relaxed);
+    slot.key.store(id, std::memory_order_release);
+
+    Instance instance;
+    instance.slot = &slot;
+    instance.message = message;
+    instance.total = total;
+    instance.width = width;
+    _instances.emplace(id, std::move(instance));
 
     //keep track of the printing order
     _order.push_back(id);
+
+    //print unless progress bars are disables
+    if (!clc::psilent) {
+      if (!_jsonl) {
+        render();
+      }
+      startRenderer();
+    }
   }
 
   //advance the progress bar with the given id by one
-  void increment(size_t id) {
-    std::lock_guard<std::mutex> lock{_pbGuard};
-    ++_instances.at(id);
-  }
+  void increment(size_t id) { increment(id, 1); }
   //advance the progress bar with the given id by n
   void increment(size_t id, size_t n) {
-    std::lock_guard<std::mutex> lock{_pbGuard};
-    _instances.at(id).increment(n);
+    if (Slot *slot = find(id)) {
+      slot->ticks.fetch_add(n, std::memory_order_relaxed);
+    }
   }
 
-  ///display the all the instances of the progress bar
-  void display() {
+  ///gauge reported with the progress records, such as the depth of a
+  ///queue; the caller updates the returned value, which stays valid as
+  ///long as the progress bar
+  std::atomic<int64_t> &gauge(const std::string &name) {
     std::lock_guard<std::mutex> lock{_pbGuard};
-
-    //print unless with are going too fast according to _displatPrintDelay
-    if ((size_t)std::chrono::duration_cast<std::chrono::milliseconds>(
-            std::chrono::steady_clock::now() - _prevDisplayTime)
-            .count() > _displayPrintDelay) {
-      printToOut();
-      _prevDisplayTime = std::chrono::steady_clock::now();
+    for (auto &[gaugeName, value] : _gauges) {
+      if (gaugeName == name) {
+        return value;
+      }
     }
+    _gauges.emplace_back(std::piecewise_construct,
+                         std::forward_as_tuple(name),
+                         std::forward_as_tuple(0));
+    return _gauges.back().second;
   }
 
+  ///the frames are printed by the render thread at a fixed rate: kept
+  ///for compatibility, does nothing
+  void display() {}
+
   ///terminate the progress bar with the given id
   void done(size_t id) {
     std::lock_guard<std::mutex> lock{_pbGuard};
-    _instances.at(id).done();
+    auto instance = _instances.find(id);
+    if (instance == _instances.end()) {
+      return;
+    }
+    if (_jsonl) {
+      if (!clc::psilent) {
+        _frame.clear();
+        appendRecord(_frame, id, instance->second,
+                     std::chrono::steady_clock::now(), true);
+        writeToOut(_frame, _fd);
+      }
+      _order.erase(std::find(begin(_order), end(_order), id));
+      instance->second.slot->key.store(tombstone,
+                                       std::memory_order_release);
+      _instances.erase(instance);
+      clearSlotsIfUnused();
+      return;
+    }
+
     //move the completed instance to the top
     auto it2 = std::find(begin(_order), end(_order), id);
-    size_t e2 = std::distance(_order.begin(), it2);
-    std::swap(_order[e2], _order[0]);
-    printToOut();
-    _instances.erase(id);
+    std::swap(*it2, _order[0]);
+    render();
+
+    //the completed instance stays on the screen, above the others
     _order.erase(begin(_order));
+    if (_printedLines >= 2) {
+      _printedLines -= 2;
+    }
+    instance->second.slot->key.store(tombstone,
+                                     std::memory_order_release);
+    _instances.erase(instance);
+    clearSlotsIfUnused();
   }
 
   ///terminate the progress bar
   void done() {
+    stopRenderer();
     std::lock_guard<std::mutex> lock{_pbGuard};
-    printToOut();
+    render(true);
 
-    if (!clc::psilent) {
+    if (!clc::psilent && !_jsonl) {
       std::cout << std::endl;
     }
     _order.clear();
     _instances.clear();
+    clearSlotsIfUnused();
+    _printedLines = 0;
   }
 
   //change the message in the progress bar
   void changeMessage(size_t id, const std::string &message) {
-    _pbGuard.lock();
-    _instances.at(id).setMessage(message);
-    _pbGuard.unlock();
-    display();
+    std::lock_guard<std::mutex> lock{_pbGuard};
+    auto instance = _instances.find(id);
+    if (instance != _instances.end()) {
+      instance->second.message = message;
+    }
   }
   void enableCounter(size_t id) {
-    std::lock_guard<std::mutex> lock{_pbGuard};
-    _instances.at(id).enableCounter();
+    if (Slot *slot = find(id)) {
+      slot->counter.store(0, std::memory_order_relaxed);
+      slot->counterEnabled.store(true, std::memory_order_relaxed);
+    }
   }
   void disableCounter(size_t id) {
-    std::lock_guard<std::mutex> lock{_pbGuard};
-    _instances.at(id).disableCounter();
-  }
-  void incrementCounter(size_t id) {
-    std::lock_guard<std::mutex> lock{_pbGuard};
-    _instances.at(id).incrementCounter();
+    if (Slot *slot = find(id)) {
+      slot->counterEnabled.store(false, std::memory_order_relaxed);
+      slot->counter.store(0, std::memory_order_relaxed);
+    }
   }
+  void incrementCounter(size_t id) { incrementCounter(id, 1); }
   void incrementCounter(size_t id, size_t n) {
-    std::lock_guard<std::mutex> lock{_pbGuard};
-    _instances.at(id).incrementCounter(n);
+    if (Slot *slot = find(id)) {
+      slot->counter.fetch_add(n, std::memory_order_relaxed);
+    }
   }
 
 private:
-  void printToOut() {
+  static constexpr size_t empty = SIZE_MAX;
+  static constexpr size_t tombstone = SIZE_MAX - 1;
+
+  ///counters of an instance, updated by the workers
+  struct alignas(64) Slot {
+    std::atomic<size_t> key{empty};
+    std::atomic<uint64_t> ticks{0};
+    std::atomic<uint64_t> counter{0};
+    std::atomic<bool> counterEnabled{false};
+  };
+
+  ///what is needed to print an instance, guarded by _pbGuard
+  struct Instance {
+    Slot *slot;
+    std::string message;
+    unsigned int total;
+    unsigned int width;
+    std::chrono::steady_clock::time_point start_time =
+        std::chrono::steady_clock::now();
+  };
+
+  size_t hash(size_t id) const {
+    return (id * 0x9e3779b97f4a7c15ULL >> 16) & _mask;
+  }
+
+  ///slot of the instance with the given id, nullptr if there is none
+  Slot *find(size_t id) {
+    size_t i = hash(id);
+    //bounded: once every slot was used, there may be no empty one left
+    for (size_t probes = 0; probes <= _mask; probes++) {
+      size_t key = _slots[i].key.load(std::memory_order_acquire);
+      if (key == id) {
+        return &_slots[i];
+      }
+      if (key == empty) {
+        return nullptr;
+      }
+      i = (i + 1) & _mask;
+    }
+    return nullptr;
+  }
+
+  ///once no instance is left, the tombstones are turned back into empty
+  ///slots, so that the probes of find stay short; called with _pbGuard
+  void clearSlotsIfUnused() {
+    if (!_instances.empty()) {
+      return;
+    }
+    for (size_t i = 0; i <= _mask; i++) {
+      _slots[i].key.store(empty, std::memory_order_release);
+    }
+  }
+
+  ///seconds since the epoch, with milliseconds
+  static std::string unixTime() {
+    char time[32];
+    snprintf(time, sizeof(time), "%.3f",
+             std::chrono::duration<double>(
+                 std::chrono::system_clock::now().time_since_epoch())
+                 .count());
+    return time;
+  }
+
+  ///append the JSON record of an instance to out
+  void appendRecord(std::string &out, size_t id,
+                    const Instance &instance,
+                    std::chrono::steady_clock::time_point now,
+                    bool done) const {
+    const Slot &slot = *instance.slot;
+    uint64_t completed = slot.ticks.load(std::memory_order_relaxed);
+    double elapsed =
+        std::chrono::duration<double>(now - instance.start_time).count();
+    double rate = elapsed > 0 ? completed / elapsed : 0;
+
+    char numbers[256];
+    out += "{\"type\":\"progress\",\"time\":" + unixTime();
+    out += ",\"id\":" + std::to_string(id) + ",\"message\":";
+    appendJsonString(out, instance.message);
+    snprintf(numbers, sizeof(numbers),
+             ",\"completed\":%llu,\"total\":%u,\"elapsed\":%.3f,"
+             "\"rate\":%.3f",
+             static_cast<unsigned long long>(completed), instance.total,
+             elapsed, rate);
+    out += numbers;
+    if (completed >= instance.total) {
+      out += ",\"eta\":0";
+    } else if (rate > 0) {
+      snprintf(numbers, sizeof(numbers), ",\"eta\":%.3f",
+               (instance.total - completed) / rate);
+      out += numbers;
+    } else {
+      out += ",\"eta\":null";
+    }
+    if (slot.counterEnabled.load(std::memory_order_relaxed)) {
+      out += ",\"counter\":" +
+             std::to_string(slot.counter.load(std::memory_order_relaxed));
+    }
+    out += done ? ",\"done\":true}\n" : ",\"done\":false}\n";
+  }
+
+  ///print the JSON records of all the instances and of the gauges, with
+  ///_pbGuard held
+  void renderJsonl(bool done) {
+    _frame.clear();
+    auto now = std::chrono::steady_clock::now();
+    for (auto &id : _order) {
+      appendRecord(_frame, id, _instances.at(id), now, done);
+    }
+    if (!_gauges.empty()) {
+      _frame += "{\"type\":\"gauges\",\"time\":" + unixTime() +
+                ",\"gauges\":{";
+      for (size_t i = 0; i < _gauges.size(); i++) {
+        _frame += i == 0 ? "" : ",";
+        appendJsonString(_frame, _gauges[i].first);
+        _frame += ":" + std::to_string(_gauges[i].second.load(
+                            std::memory_order_relaxed));
+      }
+      _frame += "}}\n";
+    }
+    writeToOut(_frame, _fd);
+  }
+
+  ///print a frame with all the instances, with _pbGuard held
+  ///@param done true for the last frame
+  void render(bool done = false) {
     //print unless progress bars are disabled
     if (clc::psilent) {
       return;
     }
+    if (_jsonl) {
+      renderJsonl(done);
+      return;
+    }
 
-    //bring cout to the begining of the progress bar
-    jumpBack(_instances.size() * 2);
+    _frame.clear();
+    //bring the cursor to the begining of the progress bar
+    jumpBack(_frame, _printedLines);
 
     //print following the order
+    auto now = std::chrono::steady_clock::now();
     for (auto &id : _order) {
+      const Instance &instance = _instances.at(id);
+      const Slot &slot = *instance.slot;
       //print the message in its own line
-      std::cout << _instances.at(id).getMessage() << std::endl;
+      _frame += instance.message;
+      if (slot.counterEnabled.load(std::memory_order_relaxed)) {
+        _frame += " ";
+        _frame +=
+            std::to_string(slot.counter.load(std::memory_order_relaxed));
+      }
+      _frame += "\n";
       //print the rest of the progress bar
-      _instances.at(id).display();
+      renderBar(_frame, slot.ticks.load(std::memory_order_relaxed),
+                instance.total, instance.width,
+                now - instance.start_time);
     }
+    _printedLines = _order.size() * 2;
+    writeToOut(_frame);
   }
 
+  size_t printDelay() const {
+    return _jsonl ? _jsonlPrintDelay : _displayPrintDelay;
+  }
+
+  void startRenderer() {
+    if (_renderer.joinable()) {
+      return;
+    }
+    _stopRenderer = false;
+    _renderer = std::thread([this] {
+      std::unique_lock<std::mutex> wakeLock{_wakeGuard};
+      while (!_wake.wait_for(wakeLock,
+                             std::chrono::milliseconds(printDelay()),
+                             [this] { return _stopRenderer; })) {
+        std::lock_guard<std::mutex> lock{_pbGuard};
+        render();
+      }
+    });
+  }
+
+  void stopRenderer() {
+    {
+      std::lock_guard<std::mutex> lock{_wakeGuard};
+      _stopRenderer = true;
+    }
+    _wake.notify_one();
+    if (_renderer.joinable()) {
+      _renderer.join();
+    }
+  }
+
+  ///table of the counters, indexed by the hash of the id
+  std::unique_ptr<Slot[]> _slots;
+  size_t _mask;
+  size_t _capacity;
+
   ///keep track of the instances
-  std::unordered_map<size_t, ProgressBar> _instances;
-  ///mutex to protect the parallel printing
+  std::unordered_map<size_t, Instance> _instances;
+  ///mutex to protect the instances and the printing
   std::mutex _pbGuard;
   ///keep track of the printing order
   std::vector<size_t> _order;
-  std::chrono::steady_clock::time_point _prevDisplayTime;
+  ///lines of the last frame, erased by the next one
+  size_t _printedLines = 0;
+  ///reused to build the frames
+  std::string _frame;
+  ///print JSON lines to _fd instead of bars
+  bool _jsonl = false;
+  int _fd = STDOUT_FILENO;
+  ///gauges by name, in order of creation
+  std::deque<std::pair<std::string, std::atomic<int64_t>>> _gauges;
+
+  std::thread _renderer;
+  std::mutex _wakeGuard;
+  std::condition_variable _wake;
+  bool _stopRenderer = false;
   //print at most once every x milliseconds
   const size_t _displayPrintDelay = 100;
+  //print at most one JSON frame every x milliseconds
+  const size_t _jsonlPrintDelay = 1000;
 };
 
 } // namespace progresscpp
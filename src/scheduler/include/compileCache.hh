@@ -0,0 +1,72 @@
+#pragma once
+
+#include <cstdint>
+#include <string>
+#include <utility>
+#include <vector>
+
+namespace flexer {
+
+/// @brief Counters of a compile cache, shared by all its users.
+struct CacheStats {
+  uint64_t hits = 0;
+  uint64_t misses = 0;
+  /// @brief Compilations the cache could not handle, such as links.
+  uint64_t uncacheable = 0;
+  /// @brief Size of the stored entries.
+  uint64_t bytes = 0;
+
+  /// @brief hits / (hits + misses), 0 without lookups.
+  double hitRate() const {
+    return hits + misses == 0 ? 0 : double(hits) / double(hits + misses);
+  }
+};
+
+/// @brief Content-addressed store of the outputs of compilations.
+/// @details An entry is the set of files produced by a compilation (the
+/// object file, the dependency file, the diagnostics), stored under the
+/// hash of everything that determines them. Entries are written to a
+/// temporary file and renamed, so concurrent compilers never see a partial
+/// entry. Once the store exceeds its size, the least recently used entries
+/// (by the mtime of their files, refreshed on each hit) are evicted. The
+/// counters and the eviction are serialized across processes with a lock
+/// file.
+class CompileCache {
+public:
+  /// @brief An output of a compilation: the suffix of the file in the
+  /// store, such as ".o", and its path in the build tree.
+  using Output = std::pair<std::string, std::string>;
+
+  CompileCache(std::string dir, uint64_t maxBytes);
+
+  /// @brief Copies the outputs of the entry to their paths and reads its
+  /// diagnostics; false if the entry or one of its outputs is missing.
+  bool fetch(const std::string &key, const std::vector<Output> &outputs,
+             std::string &diagnostics);
+
+  /// @brief Stores the outputs of a successful compilation and counts a
+  /// miss.
+  void store(const std::string &key, const std::vector<Output> &outputs,
+             const std::string &diagnostics);
+
+  /// @brief Counts a miss that was not stored, for a failed compilation.
+  void countMiss() { update(0, 1, 0, 0); }
+
+  void countUncacheable() { update(0, 0, 1, 0); }
+
+  CacheStats stats() const;
+
+  const std::string &dir() const { return _dir; }
+
+private:
+  std::string entryPath(const std::string &key,
+                        const std::string &suffix) const;
+  void update(uint64_t hits, uint64_t misses, uint64_t uncacheable,
+              int64_t bytes);
+  uint64_t evictLocked();
+
+  std::string _dir;
+  uint64_t _maxBytes;
+};
+
+} // namespace flexer
@@ -0,0 +1,39 @@
+#pragma once
+
+#include <string>
+#include <vector>
+
+namespace flexer {
+
+/// @brief What the compile cache needs to know about a compiler command
+/// line.
+struct CompilerInvocation {
+  /// @brief True for the compilation of a single source to an object
+  /// file, without options producing other outputs.
+  bool cacheable = false;
+  std::string output;
+  /// @brief Dependency file written by -MD or -MMD, empty if none.
+  std::string depFile;
+  /// @brief Command line printing the preprocessed source to stdout.
+  std::vector<std::string> preprocess;
+  /// @brief The object file records the compilation directory.
+  bool debugInfo = false;
+};
+
+/// @brief Analyzes the command line of a compiler, args[0] being the
+/// compiler itself.
+CompilerInvocation analyzeInvocation(const std::vector<std::string> &args);
+
+/// @brief Key of a compilation in the compile cache: the hash of the
+/// compiler identity, the command line, the preprocessed source and, with
+/// debug information, the working directory.
+/// @param baseDir replaced by a fixed token in the command line, the
+/// working directory and the line markers of the preprocessed source, so
+/// that the same translation unit compiled in two workspaces has the same
+/// key (as the base_dir of ccache). Usually FLEXER_WORKSPACE.
+std::string compilationKey(const std::string &identity,
+                           const std::vector<std::string> &args,
+                           bool debugInfo, const std::string &preprocessed,
+                           std::string baseDir = "");
+
+} // namespace flexer
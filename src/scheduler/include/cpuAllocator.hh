@@ -0,0 +1,57 @@
+#pragma once
+
+#include <cstddef>
+#include <string>
+#include <vector>
+
+namespace flexer {
+
+/// @brief Parses a Linux CPU list, such as "0-3,8,10-11".
+std::vector<int> parseCpuList(const std::string &list);
+
+/// @brief Formats CPUs as a Linux CPU list.
+std::string formatCpuList(const std::vector<int> &cpus);
+
+/// @brief Splits the cores flexer may use between the run slots and the
+/// compile jobs.
+/// @details The physical cores are read from the SMT topology in sysfs and
+/// restricted to the affinity of flexer. A core is given whole, with all
+/// its hardware threads, to a single run slot: concurrent benchmarks never
+/// share a core, its caches nor its frequency with each other or with the
+/// compilers. The run slots take the highest numbered cores, the compile
+/// jobs get the remaining ones. Reserved CPUs, and the other threads of
+/// their cores, are used by neither.
+class CpuAllocator {
+public:
+  /// @brief A physical core: the CPU ids of its hardware threads.
+  using Core = std::vector<int>;
+
+  /// @brief Cores of the machine usable by flexer, sorted by first CPU.
+  static std::vector<Core> readTopology();
+
+  /// @param cores usually readTopology().
+  /// @param coresPerRun physical cores given to each run slot.
+  CpuAllocator(std::vector<Core> cores, size_t runSlots, size_t coresPerRun,
+               const std::vector<int> &reserved = {});
+
+  /// @brief False if there are not enough cores to give each run slot its
+  /// own and leave one to the compile jobs; runSets is then empty and the
+  /// runs share the compile set.
+  bool pinned() const { return !_runSets.empty(); }
+
+  /// @brief CPUs of each run slot, pairwise disjoint.
+  const std::vector<std::vector<int>> &runSets() const { return _runSets; }
+
+  /// @brief CPUs of the compile jobs, disjoint from the run slots.
+  const std::vector<int> &compileSet() const { return _compileSet; }
+
+  /// @brief Human readable partition, for the log.
+  std::string describe() const;
+
+private:
+  std::vector<std::vector<int>> _runSets;
+  std::vector<int> _compileSet;
+  size_t _available = 0;
+};
+
+} // namespace flexer
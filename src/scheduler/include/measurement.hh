@@ -0,0 +1,97 @@
+#pragma once
+
+#include <cstddef>
+#include <string>
+#include <vector>
+
+#include "processRunner.hh"
+
+namespace flexer {
+
+/// @brief Quantity measured on each run of a variant.
+enum class Metric {
+  /// @brief Wall-clock time of the run script, in seconds.
+  wall,
+  /// @brief User and system CPU time, in seconds.
+  cpu,
+  /// @brief Peak resident set size, in KiB.
+  maxRss,
+  /// @brief Last number printed on stdout by the run script.
+  output,
+};
+
+/// @brief Metric named wall, cpu, maxrss or output.
+Metric parseMetric(const std::string &name);
+std::string metricName(Metric metric);
+
+/// @brief Value of the metric for a run, NaN if it has none (such as an
+/// output without a number).
+double measure(Metric metric, const ProcessResult &run);
+
+/// @brief When to stop repeating the run of a variant.
+struct RepetitionPolicy {
+  size_t minRuns = 3;
+  size_t maxRuns = 30;
+  /// @brief Width of the confidence interval of the median relative to
+  /// the median below which the measurement is precise enough.
+  double targetWidth = 0.02;
+  /// @brief Coverage of the confidence interval.
+  double confidence = 0.95;
+  /// @brief Resamples of the bootstrap.
+  size_t resamples = 2000;
+};
+
+/// @brief Robust statistics of the samples of a variant.
+struct MeasurementStats {
+  size_t count = 0;
+  double median = 0;
+  /// @brief Median absolute deviation from the median, not scaled.
+  double mad = 0;
+  double min = 0;
+  double max = 0;
+  /// @brief Bootstrap percentile confidence interval of the median.
+  double ciLow = 0;
+  double ciHigh = 0;
+  /// @brief True if the interval reached the target width.
+  bool converged = false;
+
+  /// @brief (ciHigh - ciLow) / |median|, infinite for a zero median.
+  double relativeWidth() const;
+
+  /// @brief JSON object of the statistics.
+  std::string toJson() const;
+};
+
+/// @brief Decides how many times the run of a variant is repeated: until
+/// the confidence interval of the median is narrow enough, within the
+/// bounds of the policy.
+/// @details The interval is estimated by resampling the samples with
+/// replacement; the generator is seeded with the number of samples, so
+/// the decisions are reproducible.
+class MeasurementController {
+public:
+  explicit MeasurementController(RepetitionPolicy policy)
+      : _policy(policy) {}
+
+  void add(double sample) {
+    _samples.push_back(sample);
+    _statsValid = false;
+  }
+
+  /// @brief True once no more runs are needed.
+  bool done() const;
+
+  const std::vector<double> &samples() const { return _samples; }
+
+  /// @brief Statistics of the samples, computed once per added sample.
+  const MeasurementStats &stats() const;
+
+private:
+  RepetitionPolicy _policy;
+  std::vector<double> _samples;
+  /// the bootstrap is not cheap: done and stats share its result
+  mutable MeasurementStats _stats;
+  mutable bool _statsValid = false;
+};
+
+} // namespace flexer
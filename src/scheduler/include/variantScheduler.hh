@@ -0,0 +1,162 @@
+#pragma once
+
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <cstdint>
+#include <deque>
+#include <functional>
+#include <mutex>
+#include <string>
+#include <vector>
+
+#include "ProgressBar.hpp"
+#include "measurement.hh"
+#include "processRunner.hh"
+#include "threadPool.hh"
+
+namespace flexer {
+
+/// @brief Outcome of the compile and run stages of a variant.
+struct VariantResult {
+  uint64_t variant = 0;
+  std::string workspace;
+  /// @brief False if the compile stage was not reached (cancelled) or there
+  /// is no compilation script.
+  bool compiled = false;
+  ProcessResult compile;
+  /// @brief False if the run stage was not reached or there is no run
+  /// script.
+  bool ran = false;
+  /// @brief Last run of the variant.
+  ProcessResult run;
+  /// @brief Metric of each successful run, and their statistics.
+  std::vector<double> samples;
+  MeasurementStats stats;
+  bool cancelled = false;
+
+  /// @brief True if every stage that was configured succeeded.
+  bool success() const {
+    return !cancelled && (!compiled || compile.success()) &&
+           (!ran || run.success());
+  }
+};
+
+struct SchedulerOptions {
+  /// @brief Executables run in the workspace of each variant; a stage with
+  /// an empty script is skipped.
+  std::string compilationScript;
+  std::string runScript;
+  /// @brief Variants compiled at the same time.
+  size_t compileSlots = 1;
+  /// @brief Variants run at the same time.
+  size_t runSlots = 1;
+  /// @brief Maximum number of variants compiled, or being compiled, while
+  /// waiting for a run slot; compileSlots + runSlots if zero.
+  size_t queueSize = 0;
+  std::chrono::milliseconds compileTimeout{0};
+  std::chrono::milliseconds runTimeout{0};
+  /// @brief CPUs of the compile scripts, all if empty.
+  std::vector<int> compileCpus;
+  /// @brief Disjoint CPU sets, at least runSlots of them if not empty: each
+  /// run script gets a set no other running script uses.
+  std::vector<std::vector<int>> runCpus;
+  /// @brief The run script is repeated on each variant until the
+  /// confidence interval of the median of the metric is narrow enough.
+  Metric metric = Metric::wall;
+  RepetitionPolicy repetitions;
+  /// @brief Directory where the workspaces are created.
+  std::string workspaceRoot;
+  /// @brief Polled while running: once true, no variant is started and the
+  /// running scripts are terminated. May be set by a signal handler.
+  const std::atomic<bool> *cancelRequested = nullptr;
+  /// @brief Shows the progress of the stages, if not null.
+  progresscpp::ParallelProgressBar *progress = nullptr;
+};
+
+/// @brief Runs the variants of an exploration as two-stage jobs: the
+/// compilation script, then the run script.
+/// @details The stages have separate slot limits, so that the benchmarks
+/// do not share the cores with the compilers, and overlap: variant N+1 is
+/// compiled while variant N runs. Compiled variants wait for a run slot in
+/// a bounded queue, which stops the compile stage when the run stage falls
+/// behind. A variant keeps its run slot while its run is repeated.
+///
+/// Each variant borrows a workspace from a fixed pool, from its
+/// preparation until its result is delivered: queueSize + runSlots
+/// directories named worker-<k> under workspaceRoot. The workspaces are
+/// never removed, so that a workspace keeps the build tree of the previous
+/// variants it hosted and the build system of the project only recompiles
+/// what the variant changed. prepare fills the workspace on a pool thread
+/// before the compilation starts.
+class VariantScheduler {
+public:
+  /// @brief Fills the workspace of the variant, returns the variables
+  /// added to the environment of its scripts.
+  using Prepare = std::function<std::vector<std::string>(
+      uint64_t variant, const std::string &workspace)>;
+  /// @brief Called once per variant from the thread calling run, in
+  /// completion order.
+  using OnResult = std::function<void(VariantResult &&)>;
+
+  explicit VariantScheduler(SchedulerOptions options);
+
+  /// @brief Runs the variants [0, nVariants) and waits for them.
+  void run(uint64_t nVariants, const Prepare &prepare,
+           const OnResult &onResult);
+
+  /// @brief Stops starting variants and terminates the running scripts;
+  /// thread safe.
+  void cancel();
+
+private:
+  struct Job {
+    VariantResult result;
+    std::vector<std::string> env;
+    /// index in runCpus of the CPUs of the run
+    size_t runCpus = SIZE_MAX;
+    size_t workspace = SIZE_MAX;
+    /// Tracer::now() when the job entered _compiled
+    uint64_t queuedAt = 0;
+    /// samples of the runs so far
+    MeasurementController measurement{RepetitionPolicy()};
+    /// the last run gave a sample
+    bool sampled = false;
+  };
+
+  void startCompile(uint64_t variant, size_t workspace,
+                    const Prepare &prepare);
+  void startRun(Job job);
+  void finishRun(Job &job);
+  ProcessSpec specOf(const std::string &script, const Job &job,
+                     std::chrono::milliseconds timeout,
+                     const std::vector<int> &cpus) const;
+
+  SchedulerOptions _options;
+
+  std::mutex _guard;
+  std::condition_variable _changed;
+  /// variants being prepared or compiled
+  size_t _compiling = 0;
+  size_t _running = 0;
+  /// compiled variants waiting for a run slot
+  std::deque<Job> _compiled;
+  /// variants whose last run ended, holding their run slot until their
+  /// measurement is evaluated by the thread calling run
+  std::deque<Job> _measured;
+  /// variants whose run is repeated, holding their run slot
+  std::deque<Job> _repeated;
+  std::deque<Job> _completed;
+  /// indices of the workspaces not used by a variant
+  std::vector<size_t> _freeWorkspaces;
+  /// indices in runCpus of the sets not used by a run
+  std::vector<size_t> _freeRunCpus;
+  bool _cancelled = false;
+
+  // last, so that their threads, which call back into the state above,
+  // are joined before it is destroyed
+  ProcessRunner _runner;
+  WorkStealingPool _preparePool;
+};
+
+} // namespace flexer
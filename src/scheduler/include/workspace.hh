@@ -0,0 +1,25 @@
+#pragma once
+
+#include <cstddef>
+#include <string>
+#include <unordered_set>
+#include <vector>
+
+namespace flexer {
+
+/// @brief Makes dest a copy of the project source, writing only the files
+/// whose content differs.
+/// @details The files already up to date keep their mtime, so that the
+/// build system of the project does not rebuild them. Files of dest absent
+/// from source, such as build outputs, are kept. The .flexer directory,
+/// which holds the workspaces, is not copied.
+/// @param excludes globs of the entries not copied, matched like
+/// --exclude against the entry name and its path relative to source.
+/// @param skip paths relative to source not copied, such as the files
+/// written for each variant.
+/// @return the number of files written.
+size_t syncTree(const std::string &source, const std::string &dest,
+                const std::vector<std::string> &excludes = {},
+                const std::unordered_set<std::string> &skip = {});
+
+} // namespace flexer
@@ -0,0 +1,196 @@
+#include "compileCache.hh"
+
+#include <fcntl.h>
+#include <sys/file.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <filesystem>
+#include <fstream>
+#include <sstream>
+#include <unordered_map>
+
+namespace fs = std::filesystem;
+
+namespace flexer {
+
+namespace {
+
+/// exclusive or shared flock on a file, released at destruction
+class FileLock {
+public:
+  FileLock(const std::string &path, int operation) {
+    _fd = ::open(path.c_str(), O_RDWR | O_CREAT | O_CLOEXEC, 0666);
+    if (_fd >= 0) {
+      while (::flock(_fd, operation) != 0 && errno == EINTR) {
+      }
+    }
+  }
+  ~FileLock() {
+    if (_fd >= 0) {
+      ::close(_fd);
+    }
+  }
+
+private:
+  int _fd = -1;
+};
+
+CacheStats readStats(const std::string &path) {
+  CacheStats stats;
+  std::ifstream file(path);
+  file >> stats.hits >> stats.misses >> stats.uncacheable >> stats.bytes;
+  return file ? stats : CacheStats();
+}
+
+/// copies source to dest through a temporary file renamed over dest
+bool copyAtomically(const fs::path &source, const fs::path &dest) {
+  fs::path tmp = dest;
+  tmp += ".tmp." + std::to_string(getpid());
+  std::error_code ec;
+  fs::copy_file(source, tmp, fs::copy_options::overwrite_existing, ec);
+  if (!ec) {
+    fs::rename(tmp, dest, ec);
+  }
+  if (ec) {
+    fs::remove(tmp, ec);
+    return false;
+  }
+  return true;
+}
+
+} // namespace
+
+CompileCache::CompileCache(std::string dir, uint64_t maxBytes)
+    : _dir(std::move(dir)), _maxBytes(maxBytes) {
+  std::error_code ec;
+  fs::create_directories(_dir, ec);
+}
+
+std::string CompileCache::entryPath(const std::string &key,
+                                    const std::string &suffix) const {
+  return (fs::path(_dir) / key.substr(0, 2) / (key + suffix)).string();
+}
+
+bool CompileCache::fetch(const std::string &key,
+                         const std::vector<Output> &outputs,
+                         std::string &diagnostics) {
+  for (const auto &[suffix, path] : outputs) {
+    if (!fs::exists(entryPath(key, suffix))) {
+      return false;
+    }
+  }
+  for (const auto &[suffix, path] : outputs) {
+    // the entry may have been evicted since
+    if (!copyAtomically(entryPath(key, suffix), path)) {
+      return false;
+    }
+    // most recently used
+    utimensat(AT_FDCWD, entryPath(key, suffix).c_str(), nullptr, 0);
+  }
+  std::ifstream stderrFile(entryPath(key, ".stderr"));
+  std::stringstream text;
+  text << stderrFile.rdbuf();
+  diagnostics = text.str();
+  update(1, 0, 0, 0);
+  return true;
+}
+
+void CompileCache::store(const std::string &key,
+                         const std::vector<Output> &outputs,
+                         const std::string &diagnostics) {
+  std::error_code ec;
+  fs::create_directories(fs::path(entryPath(key, "")).parent_path(), ec);
+  int64_t bytes = 0;
+  for (const auto &[suffix, path] : outputs) {
+    if (!copyAtomically(path, entryPath(key, suffix))) {
+      countMiss();
+      return;
+    }
+    bytes += fs::file_size(path, ec);
+  }
+  if (!diagnostics.empty()) {
+    std::string path = entryPath(key, ".stderr");
+    std::string tmp = path + ".tmp." + std::to_string(getpid());
+    std::ofstream(tmp, std::ios::trunc) << diagnostics;
+    fs::rename(tmp, path, ec);
+    bytes += diagnostics.size();
+  }
+  update(0, 1, 0, bytes);
+}
+
+CacheStats CompileCache::stats() const {
+  FileLock lock((fs::path(_dir) / "lock").string(), LOCK_SH);
+  return readStats((fs::path(_dir) / "stats").string());
+}
+
+void CompileCache::update(uint64_t hits, uint64_t misses,
+                          uint64_t uncacheable, int64_t bytes) {
+  std::string statsPath = (fs::path(_dir) / "stats").string();
+  FileLock lock((fs::path(_dir) / "lock").string(), LOCK_EX);
+  CacheStats stats = readStats(statsPath);
+  stats.hits += hits;
+  stats.misses += misses;
+  stats.uncacheable += uncacheable;
+  stats.bytes += bytes;
+  if (stats.bytes > _maxBytes) {
+    stats.bytes = evictLocked();
+  }
+
+  std::string tmp = statsPath + ".tmp." + std::to_string(getpid());
+  {
+    std::ofstream file(tmp, std::ios::trunc);
+    file << stats.hits << " " << stats.misses << " " << stats.uncacheable
+         << " " << stats.bytes << "\n";
+  }
+  std::error_code ec;
+  fs::rename(tmp, statsPath, ec);
+}
+
+uint64_t CompileCache::evictLocked() {
+  struct Entry {
+    uint64_t bytes = 0;
+    fs::file_time_type used = fs::file_time_type::min();
+    std::vector<fs::path> files;
+  };
+  std::unordered_map<std::string, Entry> entries;
+  uint64_t total = 0;
+  std::error_code ec;
+  for (const auto &shard : fs::directory_iterator(_dir, ec)) {
+    if (!shard.is_directory()) {
+      continue;
+    }
+    for (const auto &file : fs::directory_iterator(shard.path(), ec)) {
+      std::string name = file.path().filename().string();
+      Entry &entry = entries[name.substr(0, name.find('.'))];
+      uint64_t size = file.file_size(ec);
+      entry.bytes += size;
+      entry.used = std::max(entry.used, file.last_write_time(ec));
+      entry.files.push_back(file.path());
+      total += size;
+    }
+  }
+
+  std::vector<Entry *> lru;
+  for (auto &[key, entry] : entries) {
+    lru.push_back(&entry);
+  }
+  std::sort(lru.begin(), lru.end(), [](const Entry *a, const Entry *b) {
+    return a->used < b->used;
+  });
+  // evict below the limit, so that the next stores do not evict again
+  uint64_t target = _maxBytes / 10 * 9;
+  for (const Entry *entry : lru) {
+    if (total <= target) {
+      break;
+    }
+    for (const auto &file : entry->files) {
+      fs::remove(file, ec);
+    }
+    total -= entry->bytes;
+  }
+  return total;
+}
+
+} // namespace flexer
@@ -0,0 +1,201 @@
+#include "compilerInvocation.hh"
+
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+#include <filesystem>
+
+#include "hash.hh"
+
+namespace fs = std::filesystem;
+
+namespace flexer {
+
+namespace {
+
+bool hasPrefix(const std::string &str, const char *prefix) {
+  return str.compare(0, std::strlen(prefix), prefix) == 0;
+}
+
+bool isSource(const std::string &path) {
+  static const char *const extensions[] = {".c",   ".cc",  ".cpp", ".cxx",
+                                           ".c++", ".C",   ".cp",  ".CPP",
+                                           ".i",   ".ii"};
+  std::string extension = fs::path(path).extension().string();
+  for (const char *known : extensions) {
+    if (extension == known) {
+      return true;
+    }
+  }
+  return false;
+}
+
+/// options whose value is the next argument
+bool takesValue(const std::string &arg) {
+  static const char *const options[] = {
+      "-o",        "-I",          "-D",         "-U",        "-include",
+      "-imacros",  "-isystem",    "-iquote",    "-idirafter", "-iprefix",
+      "-isysroot", "-MF",         "-MT",        "-MQ",       "-Xpreprocessor",
+      "-Xassembler", "-Xlinker",  "-L",         "-l",        "--param",
+      "-target",   "-arch",       "-aux-info"};
+  for (const char *option : options) {
+    if (arg == option) {
+      return true;
+    }
+  }
+  return false;
+}
+
+/// options producing other outputs, or reading the source elsewhere
+bool preventsCaching(const std::string &arg) {
+  static const char *const prefixes[] = {
+      "-save-temps", "--coverage", "-fprofile-arcs", "-ftest-coverage",
+      "-gsplit-dwarf", "-fdump-", "-x", "@"};
+  if (arg == "-E" || arg == "-S" || arg == "-M" || arg == "-MM" ||
+      arg == "-") {
+    return true;
+  }
+  for (const char *prefix : prefixes) {
+    if (hasPrefix(arg, prefix)) {
+      return true;
+    }
+  }
+  return false;
+}
+
+/// text with every occurrence of the directory baseDir replaced by a fixed
+/// token; worker-1 does not match the start of worker-10
+std::string withoutBaseDir(std::string text, const std::string &baseDir) {
+  if (baseDir.empty()) {
+    return text;
+  }
+  static const std::string token = "<base-dir>";
+  size_t pos = text.find(baseDir);
+  while (pos != std::string::npos) {
+    size_t next = pos + baseDir.size();
+    if (next == text.size() ||
+        std::strchr("/\"' \t\r\n", text[next]) != nullptr) {
+      text.replace(pos, baseDir.size(), token);
+      next = pos + token.size();
+    }
+    pos = text.find(baseDir, next);
+  }
+  return text;
+}
+
+/// preprocessed source with baseDir replaced in the line markers only:
+/// __FILE__ and the like are part of the compiled code, and keep the
+/// content of each workspace apart
+std::string markersWithoutBaseDir(const std::string &preprocessed,
+                                  const std::string &baseDir) {
+  if (baseDir.empty() ||
+      preprocessed.find(baseDir) == std::string::npos) {
+    return preprocessed;
+  }
+  std::string normalized;
+  normalized.reserve(preprocessed.size());
+  size_t begin = 0;
+  while (begin < preprocessed.size()) {
+    size_t end = preprocessed.find('\n', begin);
+    end = end == std::string::npos ? preprocessed.size() : end + 1;
+    std::string line = preprocessed.substr(begin, end - begin);
+    normalized += line[0] == '#' ? withoutBaseDir(line, baseDir) : line;
+    begin = end;
+  }
+  return normalized;
+}
+
+} // namespace
+
+CompilerInvocation analyzeInvocation(const std::vector<std::string> &args) {
+  CompilerInvocation invocation;
+  std::string input;
+  bool compileOnly = false;
+  bool dependencies = false;
+  invocation.preprocess.push_back(args[0]);
+
+  for (size_t i = 1; i < args.size(); i++) {
+    const std::string &arg = args[i];
+    if (preventsCaching(arg)) {
+      return invocation;
+    }
+    bool hasValue = takesValue(arg) && i + 1 < args.size();
+    const std::string value = hasValue ? args[i + 1] : "";
+
+    if (arg == "-c") {
+      compileOnly = true;
+    } else if (arg == "-o" || hasPrefix(arg, "-o")) {
+      invocation.output = hasValue ? value : arg.substr(2);
+    } else if (arg == "-MD" || arg == "-MMD") {
+      dependencies = true;
+    } else if (hasPrefix(arg, "-MF")) {
+      invocation.depFile = hasValue ? value : arg.substr(3);
+    } else if (hasPrefix(arg, "-MT") || hasPrefix(arg, "-MQ") ||
+               arg == "-MP") {
+      // only change the dependency file, hashed with the command line
+    } else if (hasPrefix(arg, "-g")) {
+      invocation.debugInfo = arg != "-g0";
+      invocation.preprocess.push_back(arg);
+    } else if (arg[0] != '-') {
+      if (!input.empty() || !isSource(arg)) {
+        // several inputs, or a link
+        return invocation;
+      }
+      input = arg;
+      invocation.preprocess.push_back(arg);
+    } else {
+      invocation.preprocess.push_back(arg);
+      if (hasValue) {
+        invocation.preprocess.push_back(value);
+      }
+    }
+    i += hasValue ? 1 : 0;
+  }
+
+  if (!compileOnly || input.empty()) {
+    return invocation;
+  }
+  if (invocation.output.empty()) {
+    invocation.output = fs::path(input).filename().replace_extension(".o");
+  }
+  if (dependencies && invocation.depFile.empty()) {
+    invocation.depFile = fs::path(invocation.output).replace_extension(".d");
+  }
+  if (!dependencies) {
+    invocation.depFile.clear();
+  }
+  invocation.preprocess.push_back("-E");
+  invocation.cacheable = true;
+  return invocation;
+}
+
+std::string compilationKey(const std::string &identity,
+                           const std::vector<std::string> &args,
+                           bool debugInfo, const std::string &preprocessed,
+                           std::string baseDir) {
+  while (baseDir.size() > 1 && baseDir.back() == '/') {
+    baseDir.pop_back();
+  }
+  std::string header = "flexer-cc 2\n" + identity + "\n";
+  for (const auto &arg : args) {
+    header += withoutBaseDir(arg, baseDir);
+    header.push_back('\0');
+  }
+  if (debugInfo) {
+    // the object file records the compilation directory
+    header += withoutBaseDir(fs::current_path().string(), baseDir);
+  }
+  // two independent 64 bit hashes: collisions are out of reach of a local
+  // store
+  std::string normalized = markersWithoutBaseDir(preprocessed, baseDir);
+  char key[33];
+  uint64_t seeds[2] = {0x5bd1e995, 0x27d4eb2f165667c5ULL};
+  for (int i = 0; i < 2; i++) {
+    uint64_t hash = fastHash64(header, seeds[i]);
+    hash = fastHash64(normalized, hash);
+    snprintf(key + 16 * i, 17, "%016llx", (unsigned long long)hash);
+  }
+  return std::string(key, 32);
+}
+
+} // namespace flexer
@@ -0,0 +1,162 @@
+#include "cpuAllocator.hh"
+
+#include <sched.h>
+
+#include <algorithm>
+#include <cctype>
+#include <fstream>
+#include <map>
+#include <set>
+
+#include "message.hh"
+
+namespace flexer {
+
+std::vector<int> parseCpuList(const std::string &list) {
+  std::vector<int> cpus;
+  size_t i = 0;
+  while (i < list.size()) {
+    size_t end = list.find(',', i);
+    if (end == std::string::npos) {
+      end = list.size();
+    }
+    std::string item = list.substr(i, end - i);
+    i = end + 1;
+    // sysfs lists end with a newline
+    item.erase(std::remove_if(item.begin(), item.end(), ::isspace),
+               item.end());
+    if (item.empty()) {
+      continue;
+    }
+    size_t dash = item.find('-');
+    try {
+      int first = std::stoi(item.substr(0, dash));
+      int last = dash == std::string::npos ? first
+                                           : std::stoi(item.substr(dash + 1));
+      messageErrorIf(first < 0 || last < first,
+                     "Invalid CPU range: " + item);
+      // the affinity masks silently ignore the CPUs past CPU_SETSIZE
+      messageErrorIf(last >= CPU_SETSIZE,
+                     "CPU " + std::to_string(last) +
+                         " out of range, the CPUs are numbered below " +
+                         std::to_string(CPU_SETSIZE));
+      for (int cpu = first; cpu <= last; cpu++) {
+        cpus.push_back(cpu);
+      }
+    } catch (const std::logic_error &) {
+      messageError("Invalid CPU list: " + list);
+    }
+  }
+  return cpus;
+}
+
+std::string formatCpuList(const std::vector<int> &cpus) {
+  std::string list;
+  for (size_t i = 0; i < cpus.size();) {
+    size_t j = i;
+    while (j + 1 < cpus.size() && cpus[j + 1] == cpus[j] + 1) {
+      j++;
+    }
+    list += (list.empty() ? "" : ",") + std::to_string(cpus[i]);
+    if (j > i) {
+      list += "-" + std::to_string(cpus[j]);
+    }
+    i = j + 1;
+  }
+  return list;
+}
+
+std::vector<CpuAllocator::Core> CpuAllocator::readTopology() {
+  cpu_set_t allowed;
+  CPU_ZERO(&allowed);
+  messageErrorIf(sched_getaffinity(0, sizeof(allowed), &allowed) != 0,
+                 "sched_getaffinity failed");
+
+  // cores are identified by the list of their hardware threads
+  std::map<std::vector<int>, Core> cores;
+  for (int cpu = 0; cpu < CPU_SETSIZE; cpu++) {
+    if (!CPU_ISSET(cpu, &allowed)) {
+      continue;
+    }
+    std::ifstream siblings("/sys/devices/system/cpu/cpu" +
+                           std::to_string(cpu) +
+                           "/topology/thread_siblings_list");
+    std::string list;
+    std::vector<int> key;
+    if (siblings && std::getline(siblings, list)) {
+      key = parseCpuList(list);
+    }
+    if (key.empty()) {
+      // no topology (containers, old kernels): one thread per core
+      key = {cpu};
+    }
+    cores[key].push_back(cpu);
+  }
+
+  std::vector<Core> result;
+  for (auto &[siblings, core] : cores) {
+    result.push_back(std::move(core));
+  }
+  std::sort(result.begin(), result.end());
+  return result;
+}
+
+CpuAllocator::CpuAllocator(std::vector<Core> cores, size_t runSlots,
+                           size_t coresPerRun,
+                           const std::vector<int> &reserved) {
+  std::set<int> reservedSet(reserved.begin(), reserved.end());
+  cores.erase(std::remove_if(cores.begin(), cores.end(),
+                             [&reservedSet](const Core &core) {
+                               for (int cpu : core) {
+                                 if (reservedSet.count(cpu)) {
+                                   return true;
+                                 }
+                               }
+                               return false;
+                             }),
+              cores.end());
+  messageErrorIf(cores.empty(), "All the cores are reserved");
+  _available = cores.size();
+
+  if (runSlots == 0 || coresPerRun == 0 ||
+      runSlots * coresPerRun >= cores.size()) {
+    for (const auto &core : cores) {
+      _compileSet.insert(_compileSet.end(), core.begin(), core.end());
+    }
+    std::sort(_compileSet.begin(), _compileSet.end());
+    return;
+  }
+
+  size_t next = cores.size();
+  _runSets.resize(runSlots);
+  for (auto &set : _runSets) {
+    for (size_t i = 0; i < coresPerRun; i++) {
+      const Core &core = cores[--next];
+      set.insert(set.end(), core.begin(), core.end());
+    }
+    std::sort(set.begin(), set.end());
+  }
+  for (size_t i = 0; i < next; i++) {
+    _compileSet.insert(_compileSet.end(), cores[i].begin(),
+                       cores[i].end());
+  }
+  std::sort(_compileSet.begin(), _compileSet.end());
+}
+
+std::string CpuAllocator::describe() const {
+  if (!pinned()) {
+    return std::to_string(_available) +
+           " cores, too few to give each run slot its own: compile jobs "
+           "and runs share CPUs " +
+           formatCpuList(_compileSet);
+  }
+  std::string description = "compile jobs on CPUs " +
+                            formatCpuList(_compileSet);
+  for (size_t i = 0; i < _runSets.size(); i++) {
+    description += ", run slot " + std::to_string(i) + " on CPUs " +
+                   formatCpuList(_runSets[i]);
+  }
+  return description;
+}
+
+} // namespace flexer
@@ -0,0 +1,163 @@
+// Compiler wrapper caching the outputs of the compilations of the
+// variants in a content-addressed store, shared by the workspaces and the
+// exploration sessions.
+//
+//   flexer-cc <compiler> <arguments>...
+//
+// flexer exports its path to the compilation script as FLEXER_CC, to be
+// prepended to the compiler (CXX="$FLEXER_CC g++"). The key of a
+// compilation hashes the preprocessed source, the command line, the
+// identity of the compiler (path, size and mtime) and, with debug
+// information, the working directory, with the path of the workspace
+// (FLEXER_WORKSPACE) replaced by a fixed token. Compilations producing
+// anything but an object file and a dependency file are passed to the
+// compiler as they are. The store is FLEXER_CACHE_DIR (default ~/.cache/flexer), bounded
+// by FLEXER_CACHE_SIZE MiB (default 5120).
+
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include <cerrno>
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <string>
+#include <vector>
+
+#include "compileCache.hh"
+#include "compilerInvocation.hh"
+#include "processRunner.hh"
+
+using namespace flexer;
+
+namespace {
+
+/// path, size and mtime of the compiler, empty if it is not found
+std::string compilerIdentity(const std::string &compiler) {
+  std::vector<std::string> candidates;
+  if (compiler.find('/') != std::string::npos) {
+    candidates.push_back(compiler);
+  } else if (const char *path = std::getenv("PATH")) {
+    std::string dirs = path;
+    size_t begin = 0;
+    while (begin <= dirs.size()) {
+      size_t end = std::min(dirs.find(':', begin), dirs.size());
+      candidates.push_back(dirs.substr(begin, end - begin) + "/" + compiler);
+      begin = end + 1;
+    }
+  }
+  for (const auto &candidate : candidates) {
+    struct stat st;
+    if (stat(candidate.c_str(), &st) == 0 && S_ISREG(st.st_mode) &&
+        access(candidate.c_str(), X_OK) == 0) {
+      return candidate + "\n" + std::to_string(st.st_size) + "\n" +
+             std::to_string(st.st_mtim.tv_sec) + "." +
+             std::to_string(st.st_mtim.tv_nsec);
+    }
+  }
+  return "";
+}
+
+/// FLEXER_CACHE_SIZE, the default if it is not a positive number of MiB:
+/// a size of 0 would evict the whole store on every compilation
+uint64_t cacheSizeMiB() {
+  const uint64_t defaultMiB = 5120;
+  // larger sizes overflow once converted to bytes
+  const uint64_t maxMiB = UINT64_MAX / (1024 * 1024);
+  const char *size = std::getenv("FLEXER_CACHE_SIZE");
+  if (!size) {
+    return defaultMiB;
+  }
+  errno = 0;
+  char *end;
+  unsigned long long value = std::strtoull(size, &end, 10);
+  // strtoull accepts a sign, and negates the value after a '-'
+  if (end == size || *end != '\0' || errno != 0 ||
+      std::strchr(size, '-') || value == 0 || value > maxMiB) {
+    fprintf(stderr,
+            "flexer-cc: invalid FLEXER_CACHE_SIZE '%s', using %llu MiB\n",
+            size, static_cast<unsigned long long>(defaultMiB));
+    return defaultMiB;
+  }
+  return value;
+}
+
+[[noreturn]] void execCompiler(char *argv[]) {
+  execvp(argv[0], argv);
+  fprintf(stderr, "flexer-cc: cannot run %s: %s\n", argv[0],
+          strerror(errno));
+  exit(127);
+}
+
+} // namespace
+
+int main(int argc, char *argv[]) {
+  if (argc < 2) {
+    fprintf(stderr, "Usage: %s <compiler> <arguments>...\n", argv[0]);
+    return 1;
+  }
+  std::vector<std::string> args(argv + 1, argv + argc);
+
+  std::string dir;
+  if (const char *cacheDir = std::getenv("FLEXER_CACHE_DIR")) {
+    dir = cacheDir;
+  } else if (const char *home = std::getenv("HOME")) {
+    dir = std::string(home) + "/.cache/flexer";
+  } else {
+    execCompiler(argv + 1);
+  }
+  uint64_t maxMiB = cacheSizeMiB();
+  CompileCache cache(dir, maxMiB * 1024 * 1024);
+
+  CompilerInvocation invocation = analyzeInvocation(args);
+  std::string identity = compilerIdentity(args[0]);
+  if (!invocation.cacheable || identity.empty()) {
+    cache.countUncacheable();
+    execCompiler(argv + 1);
+  }
+
+  ProcessRunner runner;
+  ProcessSpec preprocess;
+  preprocess.argv = invocation.preprocess;
+  preprocess.maxOutput = size_t(1) << 31;
+  ProcessResult preprocessed = runner.run(preprocess);
+  if (!preprocessed.success() || preprocessed.truncated) {
+    // let the compiler report the error
+    cache.countUncacheable();
+    execCompiler(argv + 1);
+  }
+
+  // identical translation units of different workspaces share an entry
+  const char *workspace = std::getenv("FLEXER_WORKSPACE");
+  std::string key = compilationKey(identity, args, invocation.debugInfo,
+                                   preprocessed.out,
+                                   workspace ? workspace : "");
+  std::vector<CompileCache::Output> outputs = {{".o", invocation.output}};
+  if (!invocation.depFile.empty()) {
+    outputs.push_back({".d", invocation.depFile});
+  }
+
+  std::string diagnostics;
+  if (cache.fetch(key, outputs, diagnostics)) {
+    fputs(diagnostics.c_str(), stderr);
+    return 0;
+  }
+
+  ProcessSpec compile;
+  compile.argv = args;
+  ProcessResult compiled = runner.run(compile);
+  fwrite(compiled.out.data(), 1, compiled.out.size(), stdout);
+  fwrite(compiled.err.data(), 1, compiled.err.size(), stderr);
+  if (!compiled.spawned) {
+    fprintf(stderr, "flexer-cc: cannot run %s: %s\n", argv[1],
+            strerror(compiled.spawnError));
+    return 127;
+  }
+  if (compiled.success()) {
+    cache.store(key, outputs, compiled.err);
+  } else {
+    cache.countMiss();
+  }
+  return compiled.signal ? 128 + compiled.signal : compiled.exitCode;
+}
@@ -0,0 +1,168 @@
+#include "measurement.hh"
+
+#include <algorithm>
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+#include <limits>
+#include <random>
+
+#include "message.hh"
+
+namespace flexer {
+
+namespace {
+
+/// median of the values, which are reordered
+double medianOf(std::vector<double> &values) {
+  size_t half = values.size() / 2;
+  std::nth_element(values.begin(), values.begin() + half, values.end());
+  double upper = values[half];
+  if (values.size() % 2 == 1) {
+    return upper;
+  }
+  double lower = *std::max_element(values.begin(), values.begin() + half);
+  return (lower + upper) / 2;
+}
+
+/// last number of the last non-empty line of text
+double lastNumber(const std::string &text) {
+  size_t end = text.find_last_not_of(" \t\r\n");
+  if (end == std::string::npos) {
+    return std::numeric_limits<double>::quiet_NaN();
+  }
+  size_t begin = text.find_last_of(" \t\r\n", end);
+  begin = begin == std::string::npos ? 0 : begin + 1;
+  std::string token = text.substr(begin, end + 1 - begin);
+  char *parsed;
+  double value = std::strtod(token.c_str(), &parsed);
+  return parsed == token.c_str() + token.size()
+             ? value
+             : std::numeric_limits<double>::quiet_NaN();
+}
+
+} // namespace
+
+Metric parseMetric(const std::string &name) {
+  if (name == "wall") {
+    return Metric::wall;
+  }
+  if (name == "cpu") {
+    return Metric::cpu;
+  }
+  if (name == "maxrss") {
+    return Metric::maxRss;
+  }
+  if (name == "output") {
+    return Metric::output;
+  }
+  messageError("Unknown metric: " + name +
+               " (expected wall, cpu, maxrss or output)");
+  return Metric::wall;
+}
+
+std::string metricName(Metric metric) {
+  switch (metric) {
+  case Metric::wall:
+    return "wall";
+  case Metric::cpu:
+    return "cpu";
+  case Metric::maxRss:
+    return "maxrss";
+  case Metric::output:
+    return "output";
+  }
+  return "";
+}
+
+double measure(Metric metric, const ProcessResult &run) {
+  switch (metric) {
+  case Metric::wall:
+    return run.wallTime.count() / 1e9;
+  case Metric::cpu:
+    return (run.usage.userTime + run.usage.systemTime).count() / 1e6;
+  case Metric::maxRss:
+    return double(run.usage.maxRss);
+  case Metric::output:
+    return lastNumber(run.out);
+  }
+  return std::numeric_limits<double>::quiet_NaN();
+}
+
+double MeasurementStats::relativeWidth() const {
+  return median == 0 ? std::numeric_limits<double>::infinity()
+                     : (ciHigh - ciLow) / std::fabs(median);
+}
+
+std::string MeasurementStats::toJson() const {
+  char width[32] = "null";
+  if (std::isfinite(relativeWidth())) {
+    snprintf(width, sizeof(width), "%.9g", relativeWidth());
+  }
+  char buffer[320];
+  snprintf(buffer, sizeof(buffer),
+           "{\"count\":%zu,\"median\":%.9g,\"mad\":%.9g,\"min\":%.9g,"
+           "\"max\":%.9g,\"ciLow\":%.9g,\"ciHigh\":%.9g,"
+           "\"relativeWidth\":%s,\"converged\":%s}",
+           count, median, mad, min, max, ciLow, ciHigh, width,
+           converged ? "true" : "false");
+  return buffer;
+}
+
+bool MeasurementController::done() const {
+  if (_samples.size() >= _policy.maxRuns) {
+    return true;
+  }
+  if (_samples.size() < _policy.minRuns) {
+    return false;
+  }
+  return stats().converged;
+}
+
+const MeasurementStats &MeasurementController::stats() const {
+  if (_statsValid) {
+    return _stats;
+  }
+  _statsValid = true;
+  MeasurementStats &stats = _stats;
+  stats = MeasurementStats();
+  stats.count = _samples.size();
+  if (_samples.empty()) {
+    return stats;
+  }
+
+  std::vector<double> values = _samples;
+  stats.median = medianOf(values);
+  auto [min, max] = std::minmax_element(_samples.begin(), _samples.end());
+  stats.min = *min;
+  stats.max = *max;
+  for (auto &value : values) {
+    value = std::fabs(value - stats.median);
+  }
+  stats.mad = medianOf(values);
+
+  std::mt19937_64 generator(_samples.size());
+  std::uniform_int_distribution<size_t> pick(0, _samples.size() - 1);
+  std::vector<double> medians(std::max<size_t>(1, _policy.resamples));
+  std::vector<double> resample(_samples.size());
+  for (auto &median : medians) {
+    for (auto &value : resample) {
+      value = _samples[pick(generator)];
+    }
+    median = medianOf(resample);
+  }
+  std::sort(medians.begin(), medians.end());
+  double alpha = (1 - _policy.confidence) / 2;
+  auto quantile = [&medians](double q) {
+    size_t i = std::min(medians.size() - 1,
+                        static_cast<size_t>(q * (medians.size() - 1) + 0.5));
+    return medians[i];
+  };
+  stats.ciLow = quantile(alpha);
+  stats.ciHigh = quantile(1 - alpha);
+  stats.converged = stats.count >= _policy.minRuns &&
+                    stats.relativeWidth() <= _policy.targetWidth;
+  return stats;
+}
+
+} // namespace flexer
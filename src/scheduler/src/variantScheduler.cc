@@ -0,0 +1,284 @@
+#include "variantScheduler.hh"
+
+#include <algorithm>
+#include <cmath>
+#include <filesystem>
+#include <memory>
+
+#include "cpuAllocator.hh"
+#include "message.hh"
+#include "trace.hh"
+
+namespace flexer {
+
+namespace {
+
+// ids of the progress bar instances and gauges
+constexpr size_t compileBar = 0;
+constexpr size_t runBar = 1;
+
+} // namespace
+
+VariantScheduler::VariantScheduler(SchedulerOptions options)
+    : _options(std::move(options)),
+      _preparePool(std::max<size_t>(1, _options.compileSlots)) {
+  _options.compileSlots = std::max<size_t>(1, _options.compileSlots);
+  _options.runSlots = std::max<size_t>(1, _options.runSlots);
+  if (_options.queueSize == 0) {
+    _options.queueSize = _options.compileSlots + _options.runSlots;
+  }
+  messageErrorIf(!_options.runCpus.empty() &&
+                     _options.runCpus.size() < _options.runSlots,
+                 "Fewer CPU sets than run slots");
+  for (size_t i = _options.runCpus.size(); i-- > 0;) {
+    _freeRunCpus.push_back(i);
+  }
+  // every variant between its preparation and the end of its run
+  for (size_t i = _options.queueSize + _options.runSlots; i-- > 0;) {
+    _freeWorkspaces.push_back(i);
+  }
+}
+
+void VariantScheduler::cancel() {
+  {
+    std::lock_guard<std::mutex> lock{_guard};
+    _cancelled = true;
+  }
+  _runner.cancelAll();
+  _changed.notify_all();
+}
+
+ProcessSpec VariantScheduler::specOf(
+    const std::string &script, const Job &job,
+    std::chrono::milliseconds timeout, const std::vector<int> &cpus) const {
+  ProcessSpec spec;
+  spec.argv = {script};
+  spec.env = job.env;
+  spec.workingDirectory = job.result.workspace;
+  spec.timeout = timeout;
+  spec.cpus = cpus;
+  if (!cpus.empty()) {
+    spec.env.push_back("FLEXER_CPUS=" + formatCpuList(cpus));
+  }
+  return spec;
+}
+
+void VariantScheduler::startCompile(uint64_t variant, size_t workspace,
+                                    const Prepare &prepare) {
+  _preparePool.submit([this, variant, workspace, &prepare] {
+    auto job = std::make_shared<Job>();
+    job->result.variant = variant;
+    job->measurement = MeasurementController(_options.repetitions);
+    job->workspace = workspace;
+    job->result.workspace =
+        (std::filesystem::path(_options.workspaceRoot) /
+         ("worker-" + std::to_string(workspace)))
+            .string();
+
+    bool cancelled;
+    {
+      std::lock_guard<std::mutex> lock{_guard};
+      cancelled = _cancelled;
+    }
+    if (!cancelled) {
+      std::error_code ec;
+      std::filesystem::create_directories(job->result.workspace, ec);
+      messageErrorIf(ec, "Failed to create the workspace " +
+                             job->result.workspace + ": " + ec.message());
+      job->env = prepare(variant, job->result.workspace);
+      job->env.push_back("FLEXER_VARIANT=" + std::to_string(variant));
+      job->env.push_back("FLEXER_WORKSPACE=" + job->result.workspace);
+    }
+
+    auto compiled = [this, job](bool cancelled) {
+      {
+        std::lock_guard<std::mutex> lock{_guard};
+        _compiling--;
+        job->result.cancelled = cancelled || _cancelled;
+        bool failed = job->result.compiled && !job->result.compile.success();
+        if (job->result.cancelled || failed ||
+            _options.runScript.empty()) {
+          _completed.push_back(std::move(*job));
+        } else {
+          job->queuedAt = Tracer::enabled() ? Tracer::now() : 0;
+          _compiled.push_back(std::move(*job));
+        }
+        // still locked: once released, run may return and destroy the
+        // scheduler
+        if (_options.progress) {
+          _options.progress->increment(compileBar);
+        }
+        _changed.notify_all();
+      }
+    };
+
+    if (cancelled || _options.compilationScript.empty()) {
+      compiled(cancelled);
+      return;
+    }
+    _runner.start(specOf(_options.compilationScript, *job,
+                         _options.compileTimeout, _options.compileCpus),
+                  [job, compiled](ProcessResult &&result) {
+                    job->result.compiled = true;
+                    job->result.compile = std::move(result);
+                    compiled(false);
+                  });
+  });
+}
+
+void VariantScheduler::startRun(Job job) {
+  auto shared = std::make_shared<Job>(std::move(job));
+  _runner.start(
+      specOf(_options.runScript, *shared, _options.runTimeout,
+             shared->runCpus == SIZE_MAX
+                 ? std::vector<int>()
+                 : _options.runCpus[shared->runCpus]),
+      [this, shared](ProcessResult &&result) {
+        auto &variant = shared->result;
+        variant.ran = true;
+        variant.run = std::move(result);
+        shared->sampled = false;
+        if (variant.run.success()) {
+          double sample = measure(_options.metric, variant.run);
+          // without a value, further runs cannot improve the measurement
+          if (!std::isnan(sample)) {
+            shared->measurement.add(sample);
+            shared->sampled = true;
+          }
+        }
+        std::lock_guard<std::mutex> lock{_guard};
+        _measured.push_back(std::move(*shared));
+        _changed.notify_all();
+      });
+}
+
+void VariantScheduler::finishRun(Job &job) {
+  _running--;
+  if (job.runCpus != SIZE_MAX) {
+    _freeRunCpus.push_back(job.runCpus);
+  }
+  _completed.push_back(std::move(job));
+  if (_options.progress) {
+    _options.progress->increment(runBar);
+  }
+}
+
+void VariantScheduler::run(uint64_t nVariants, const Prepare &prepare,
+                           const OnResult &onResult) {
+  std::atomic<int64_t> *queueDepth = nullptr;
+  if (_options.progress) {
+    _options.progress->addInstance(compileBar, "Compiled variants",
+                                   nVariants, 50);
+    _options.progress->addInstance(runBar, "Ran variants", nVariants, 50);
+    queueDepth = &_options.progress->gauge("compiled variants waiting");
+  }
+
+  uint64_t next = 0;
+  std::unique_lock<std::mutex> lock{_guard};
+  while (true) {
+    if (!_cancelled && _options.cancelRequested &&
+        _options.cancelRequested->load()) {
+      lock.unlock();
+      cancel();
+      lock.lock();
+    }
+
+    // evaluated here rather than on the event loop of the runner, and
+    // unlocked: the bootstrap of the statistics is not cheap
+    while (!_measured.empty()) {
+      Job job = std::move(_measured.front());
+      _measured.pop_front();
+      lock.unlock();
+      bool repeat = job.sampled && !job.measurement.done();
+      job.result.samples = job.measurement.samples();
+      job.result.stats = job.measurement.stats();
+      lock.lock();
+      if (repeat && !_cancelled) {
+        _repeated.push_back(std::move(job));
+      } else {
+        job.result.cancelled = job.result.run.cancelled;
+        finishRun(job);
+      }
+    }
+
+    if (_cancelled) {
+      // the compiled variants will never run
+      while (!_compiled.empty()) {
+        _compiled.front().result.cancelled = true;
+        _completed.push_back(std::move(_compiled.front()));
+        _compiled.pop_front();
+      }
+      // the samples of the interrupted measurements are kept
+      while (!_repeated.empty()) {
+        _repeated.front().result.cancelled = true;
+        finishRun(_repeated.front());
+        _repeated.pop_front();
+      }
+    }
+
+    while (!_cancelled && !_repeated.empty()) {
+      Job job = std::move(_repeated.front());
+      _repeated.pop_front();
+      lock.unlock();
+      startRun(std::move(job));
+      lock.lock();
+    }
+
+    // first the runs, so that compiled variants leave the queue
+    while (!_cancelled && _running < _options.runSlots &&
+           !_compiled.empty()) {
+      Job job = std::move(_compiled.front());
+      _compiled.pop_front();
+      _running++;
+      if (!_freeRunCpus.empty()) {
+        job.runCpus = _freeRunCpus.back();
+        _freeRunCpus.pop_back();
+      }
+      lock.unlock();
+      if (job.queuedAt != 0) {
+        Tracer::record("wait for a run slot", job.queuedAt, Tracer::now(),
+                       "variant " + std::to_string(job.result.variant));
+      }
+      startRun(std::move(job));
+      lock.lock();
+    }
+
+    while (!_cancelled && next < nVariants &&
+           _compiling < _options.compileSlots &&
+           _compiling + _compiled.size() < _options.queueSize &&
+           !_freeWorkspaces.empty()) {
+      _compiling++;
+      size_t workspace = _freeWorkspaces.back();
+      _freeWorkspaces.pop_back();
+      startCompile(next++, workspace, prepare);
+    }
+
+    if (queueDepth) {
+      queueDepth->store(_compiled.size(), std::memory_order_relaxed);
+    }
+
+    while (!_completed.empty()) {
+      Job job = std::move(_completed.front());
+      _completed.pop_front();
+      lock.unlock();
+      onResult(std::move(job.result));
+      lock.lock();
+      // the result may refer to files of the workspace until now
+      _freeWorkspaces.push_back(job.workspace);
+    }
+
+    if ((next == nVariants || _cancelled) && _compiling == 0 &&
+        _running == 0 && _compiled.empty() && _completed.empty()) {
+      break;
+    }
+    // the timeout polls cancelRequested
+    _changed.wait_for(lock, std::chrono::milliseconds(100));
+  }
+  lock.unlock();
+
+  if (_options.progress) {
+    _options.progress->done();
+  }
+}
+
+} // namespace flexer
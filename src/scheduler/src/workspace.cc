@@ -0,0 +1,119 @@
+#include "workspace.hh"
+
+#include <fnmatch.h>
+#include <unistd.h>
+
+#include <cstring>
+#include <filesystem>
+
+#include "mappedFile.hh"
+#include "message.hh"
+
+namespace fs = std::filesystem;
+
+namespace flexer {
+
+namespace {
+
+bool sameContent(const fs::path &a, const fs::path &b) {
+  MappedFile first(a.string());
+  MappedFile second(b.string());
+  return first.isOpen() && second.isOpen() &&
+         first.size() == second.size() &&
+         (first.size() == 0 ||
+          std::memcmp(first.data(), second.data(), first.size()) == 0);
+}
+
+bool isExcluded(const std::string &name, const std::string &relative,
+                const std::vector<std::string> &excludes) {
+  if (name == ".flexer") {
+    return true;
+  }
+  for (const auto &glob : excludes) {
+    if (fnmatch(glob.c_str(), name.c_str(), 0) == 0 ||
+        fnmatch(glob.c_str(), relative.c_str(), FNM_PATHNAME) == 0) {
+      return true;
+    }
+  }
+  return false;
+}
+
+} // namespace
+
+size_t syncTree(const std::string &source, const std::string &dest,
+                const std::vector<std::string> &excludes,
+                const std::unordered_set<std::string> &skip) {
+  size_t written = 0;
+  std::error_code ec;
+  fs::create_directories(dest, ec);
+  messageErrorIf(ec, "Failed to create directory " + dest + ": " +
+                         ec.message());
+
+  // an unreadable entry of the project is skipped with a warning, it must
+  // not abort the exploration
+  std::error_code walkEc;
+  auto entry = fs::recursive_directory_iterator(
+      source, fs::directory_options::skip_permission_denied, walkEc);
+  for (; !walkEc && entry != fs::recursive_directory_iterator();
+       entry.increment(walkEc)) {
+    const fs::path &path = entry->path();
+    fs::path relative = path.lexically_relative(source);
+    if (isExcluded(path.filename().string(), relative.string(), excludes)) {
+      entry.disable_recursion_pending();
+      continue;
+    }
+    if (skip.count(relative.string())) {
+      continue;
+    }
+    fs::path target = fs::path(dest) / relative;
+
+    fs::file_status status = entry->symlink_status(ec);
+    if (ec) {
+      messageWarning("Cannot read " + path.string() + ": " + ec.message());
+      continue;
+    }
+    if (fs::is_symlink(status)) {
+      fs::path link = fs::read_symlink(path, ec);
+      if (ec) {
+        messageWarning("Cannot read symlink " + path.string() + ": " +
+                       ec.message());
+        continue;
+      }
+      if (fs::read_symlink(target, ec) == link && !ec) {
+        continue;
+      }
+      fs::remove(target, ec);
+      fs::create_symlink(link, target, ec);
+      messageErrorIf(ec, "Failed to create symlink " + target.string() +
+                             ": " + ec.message());
+      written++;
+    } else if (fs::is_directory(status)) {
+      if (access(path.c_str(), R_OK | X_OK) != 0) {
+        messageWarning("Cannot read directory " + path.string() + ": " +
+                       std::string(strerror(errno)));
+        entry.disable_recursion_pending();
+        continue;
+      }
+      fs::create_directory(target, ec);
+    } else if (fs::is_regular_file(status)) {
+      if (fs::exists(target, ec) && !ec && sameContent(path, target)) {
+        continue;
+      }
+      if (access(path.c_str(), R_OK) != 0) {
+        messageWarning("Cannot read " + path.string() + ": " +
+                       std::string(strerror(errno)));
+        continue;
+      }
+      fs::copy_file(path, target, fs::copy_options::overwrite_existing, ec);
+      messageErrorIf(ec, "Failed to copy " + path.string() + " to " +
+                             target.string() + ": " + ec.message());
+      written++;
+    }
+  }
+  messageWarningIf(walkEc, "Cannot read the project tree " + source +
+                               ", the workspace " + dest +
+                               " may be incomplete: " + walkEc.message());
+  return written;
+}
+
+} // namespace flexer
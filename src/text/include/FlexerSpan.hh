@@ -0,0 +1,95 @@
+#pragma once
+#include <cstdint>
+#include <cstdlib>
+#include <deque>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <string_view>
+#include <unordered_map>
+
+#include "FlexerInstance.hh"
+#include "mappedFile.hh"
+
+namespace flexer {
+
+/// @brief Content of a source file shared by all the views on its flexer
+/// instances; the file stays mapped while a view references it
+using FileBuffer = std::shared_ptr<const MappedFile>;
+
+/// @brief Table interning file names: each distinct name is stored once and
+/// referred to by an integer handle
+class FileNameTable {
+ public:
+  using Handle = uint32_t;
+
+  /// @brief Handle of name, added to the table if not present
+  Handle intern(std::string_view name) {
+    std::lock_guard<std::mutex> lock{_guard};
+    auto it = _handles.find(name);
+    if (it != _handles.end()) {
+      return it->second;
+    }
+    Handle handle = static_cast<Handle>(_names.size());
+    // deque elements never move: the keys of _handles stay valid
+    _names.emplace_back(name);
+    _handles.emplace(_names.back(), handle);
+    return handle;
+  }
+
+  const std::string& name(Handle handle) const {
+    std::lock_guard<std::mutex> lock{_guard};
+    return _names[handle];
+  }
+
+  size_t size() const {
+    std::lock_guard<std::mutex> lock{_guard};
+    return _names.size();
+  }
+
+ private:
+  mutable std::mutex _guard;
+  std::deque<std::string> _names;
+  std::unordered_map<std::string_view, Handle> _handles;
+};
+
+/// @brief Location of a flexer instance as byte offsets [begin, end) into
+/// the content of its file
+struct FlexerSpan {
+  FileNameTable::Handle file;
+  size_t idBegin;
+  size_t idEnd;
+  size_t textBegin;
+  size_t textEnd;
+  size_t startLine;
+  size_t endLine;
+};
+
+/// @brief Zero-copy flexer instance: the ID and the text are views into the
+/// shared buffer of the file
+struct FlexerInstanceView {
+  FileBuffer buffer;
+  FlexerSpan span;
+
+  std::string_view id() const {
+    return std::string_view(buffer->data() + span.idBegin,
+                            span.idEnd - span.idBegin);
+  }
+
+  std::string_view text() const {
+    return std::string_view(buffer->data() + span.textBegin,
+                            span.textEnd - span.textBegin);
+  }
+
+  const std::string& fileName(const FileNameTable& names) const {
+    return names.name(span.file);
+  }
+
+  /// @brief Owning copy of the instance
+  FlexerInstance toInstance(const FileNameTable& names) const {
+    return {std::string(id()), std::string(text()), span.startLine,
+            span.endLine, fileName(names)};
+  }
+};
+
+}  // namespace flexer
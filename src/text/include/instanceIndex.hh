@@ -0,0 +1,379 @@
+#pragma once
+
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <cstdint>
+#include <cstdio>
+#include <filesystem>
+#include <fstream>
+#include <memory>
+#include <string>
+#include <string_view>
+#include <vector>
+
+#include "FlexerInstance.hh"
+#include "hash.hh"
+#include "mappedFile.hh"
+#include "message.hh"
+#include "profiler.hh"
+#include "text.hh"
+
+namespace flexer {
+
+/// @brief Metadata used to decide whether a file changed since it was
+/// indexed
+struct FileStamp {
+  uint64_t size = 0;
+  int64_t mtimeNs = 0;
+  uint64_t inode = 0;
+
+  bool operator==(const FileStamp& other) const {
+    return size == other.size && mtimeNs == other.mtimeNs &&
+           inode == other.inode;
+  }
+};
+
+/// @brief Stamp of the file at path, false if it cannot be stat'ed
+inline bool stampFile(const std::string& path, FileStamp& stamp) {
+  struct stat st;
+  if (::stat(path.c_str(), &st) != 0) {
+    return false;
+  }
+  stamp.size = static_cast<uint64_t>(st.st_size);
+  stamp.mtimeNs = static_cast<int64_t>(st.st_mtim.tv_sec) * 1000000000 +
+                  st.st_mtim.tv_nsec;
+  stamp.inode = static_cast<uint64_t>(st.st_ino);
+  return true;
+}
+
+/// @brief On-disk index of the flexer instances of a project
+/// @details The index is a single binary file made of a header, a table of
+/// file records sorted by path, a table of instance records and a blob
+/// holding all the strings. It is memory mapped and queried in place: no
+/// record is allocated when loading it.
+class InstanceIndex {
+ public:
+  static constexpr char magic[8] = {'F', 'L', 'X', 'I', 'D', 'X', '\0', '\0'};
+  static constexpr uint32_t version = 1;
+
+  struct Header {
+    char magic[8];
+    uint32_t version;
+    uint32_t nFiles;
+    uint64_t nInstances;
+    uint64_t stringsSize;
+  };
+
+  struct FileRecord {
+    uint64_t pathOffset;
+    uint32_t pathLength;
+    uint32_t nInstances;
+    uint64_t firstInstance;
+    uint64_t size;
+    int64_t mtimeNs;
+    uint64_t inode;
+    uint64_t contentHash;
+  };
+
+  struct InstanceRecord {
+    uint64_t idOffset;
+    uint32_t idLength;
+    uint32_t reserved;
+    uint64_t textOffset;
+    uint64_t textLength;
+    uint64_t startLine;
+    uint64_t endLine;
+  };
+
+  /// @brief Map the index at path; an index that is missing or was written
+  /// by another version is treated as empty
+  explicit InstanceIndex(const std::string& path) : _file(path) {
+    FLEXER_PROFILE_SCOPE("load index");
+    if (!_file.isOpen() || _file.size() == 0) {
+      return;
+    }
+
+    const Header* header = reinterpret_cast<const Header*>(_file.data());
+    if (_file.size() < sizeof(Header) ||
+        !std::equal(magic, magic + sizeof(magic), header->magic) ||
+        header->version != version) {
+      messageWarning("Ignoring incompatible flexer index: " + path);
+      return;
+    }
+
+    // the counts are bounded first, so that the sizes cannot overflow
+    if (header->nFiles > _file.size() / sizeof(FileRecord) ||
+        header->nInstances > _file.size() / sizeof(InstanceRecord) ||
+        header->stringsSize > _file.size()) {
+      messageWarning("Ignoring corrupted flexer index: " + path);
+      return;
+    }
+    uint64_t expectedSize = sizeof(Header) +
+                            header->nFiles * sizeof(FileRecord) +
+                            header->nInstances * sizeof(InstanceRecord) +
+                            header->stringsSize;
+    if (expectedSize != _file.size()) {
+      messageWarning("Ignoring corrupted flexer index: " + path);
+      return;
+    }
+
+    _files = reinterpret_cast<const FileRecord*>(header + 1);
+    _nFiles = header->nFiles;
+    _instances = reinterpret_cast<const InstanceRecord*>(_files + _nFiles);
+    _nInstances = header->nInstances;
+    _strings = reinterpret_cast<const char*>(_instances + _nInstances);
+    _stringsSize = header->stringsSize;
+
+    // reject records pointing outside of the index
+    auto outside = [](uint64_t offset, uint64_t length, uint64_t size) {
+      return offset > size || length > size - offset;
+    };
+    for (size_t i = 0; i < _nFiles; i++) {
+      const FileRecord& file = _files[i];
+      if (outside(file.pathOffset, file.pathLength, _stringsSize) ||
+          outside(file.firstInstance, file.nInstances, _nInstances)) {
+        messageWarning("Ignoring corrupted flexer index: " + path);
+        _nFiles = 0;
+        return;
+      }
+    }
+    for (size_t i = 0; i < _nInstances; i++) {
+      const InstanceRecord& instance = _instances[i];
+      if (outside(instance.idOffset, instance.idLength, _stringsSize) ||
+          outside(instance.textOffset, instance.textLength, _stringsSize)) {
+        messageWarning("Ignoring corrupted flexer index: " + path);
+        _nFiles = 0;
+        return;
+      }
+    }
+  }
+
+  InstanceIndex(const InstanceIndex&) = delete;
+  InstanceIndex& operator=(const InstanceIndex&) = delete;
+
+  size_t size() const { return _nFiles; }
+
+  /// @brief Record of the file with the given path, nullptr if the file is
+  /// not indexed
+  const FileRecord* find(std::string_view path) const {
+    const FileRecord* end = _files + _nFiles;
+    const FileRecord* it =
+        std::lower_bound(_files, end, path,
+                         [this](const FileRecord& record, std::string_view p) {
+                           return pathOf(record) < p;
+                         });
+    return it != end && pathOf(*it) == path ? it : nullptr;
+  }
+
+  std::string_view pathOf(const FileRecord& record) const {
+    return std::string_view(_strings + record.pathOffset, record.pathLength);
+  }
+
+  FileStamp stampOf(const FileRecord& record) const {
+    return {record.size, record.mtimeNs, record.inode};
+  }
+
+  /// @brief Rebuild the instances of an indexed file
+  std::vector<FlexerInstance> instancesOf(const FileRecord& record) const {
+    std::vector<FlexerInstance> instances;
+    instances.reserve(record.nInstances);
+    std::string fileName(pathOf(record));
+    for (size_t i = 0; i < record.nInstances; i++) {
+      const InstanceRecord& instance = _instances[record.firstInstance + i];
+      instances.push_back(
+          {std::string(_strings + instance.idOffset, instance.idLength),
+           std::string(_strings + instance.textOffset, instance.textLength),
+           instance.startLine, instance.endLine, fileName});
+    }
+    return instances;
+  }
+
+ private:
+  MappedFile _file;
+  const FileRecord* _files = nullptr;
+  size_t _nFiles = 0;
+  const InstanceRecord* _instances = nullptr;
+  size_t _nInstances = 0;
+  const char* _strings = nullptr;
+  size_t _stringsSize = 0;
+};
+
+/// @brief Serialize the instances of a set of files into an index file
+/// @details The file is written next to its destination and renamed over
+/// it, so that a concurrent reader never sees a partial index
+class InstanceIndexWriter {
+ public:
+  /// @brief Add a file with its instances, which must all belong to it
+  void addFile(const std::string& path, const FileStamp& stamp,
+               uint64_t contentHash,
+               std::vector<FlexerInstance>::const_iterator beginInstance,
+               std::vector<FlexerInstance>::const_iterator endInstance) {
+    _entries.push_back(
+        {path, stamp, contentHash, beginInstance, endInstance});
+  }
+
+  void write(const std::string& path) {
+    FLEXER_PROFILE_SCOPE("write index");
+    std::sort(_entries.begin(), _entries.end(),
+              [](const Entry& a, const Entry& b) { return a.path < b.path; });
+
+    std::vector<InstanceIndex::FileRecord> files;
+    std::vector<InstanceIndex::InstanceRecord> instances;
+    std::string strings;
+    files.reserve(_entries.size());
+
+    for (const auto& entry : _entries) {
+      InstanceIndex::FileRecord file{};
+      file.pathOffset = appendString(strings, entry.path);
+      file.pathLength = static_cast<uint32_t>(entry.path.size());
+      file.nInstances =
+          static_cast<uint32_t>(entry.endInstance - entry.beginInstance);
+      file.firstInstance = instances.size();
+      file.size = entry.stamp.size;
+      file.mtimeNs = entry.stamp.mtimeNs;
+      file.inode = entry.stamp.inode;
+      file.contentHash = entry.contentHash;
+      files.push_back(file);
+
+      for (auto it = entry.beginInstance; it != entry.endInstance; ++it) {
+        InstanceIndex::InstanceRecord instance{};
+        instance.idOffset = appendString(strings, it->id);
+        instance.idLength = static_cast<uint32_t>(it->id.size());
+        instance.textOffset = appendString(strings, it->text);
+        instance.textLength = it->text.size();
+        instance.startLine = it->startLine;
+        instance.endLine = it->endLine;
+        instances.push_back(instance);
+      }
+    }
+
+    InstanceIndex::Header header{};
+    std::copy(InstanceIndex::magic,
+              InstanceIndex::magic + sizeof(InstanceIndex::magic),
+              header.magic);
+    header.version = InstanceIndex::version;
+    header.nFiles = static_cast<uint32_t>(files.size());
+    header.nInstances = instances.size();
+    header.stringsSize = strings.size();
+
+    std::error_code ec;
+    std::filesystem::create_directories(
+        std::filesystem::path(path).parent_path(), ec);
+
+    // unique per process: concurrent runs on the same project must not
+    // write the same temporary file
+    std::string tmpPath = path + ".tmp." + std::to_string(getpid());
+    std::ofstream out(tmpPath, std::ios::binary | std::ios::trunc);
+    if (!out.is_open()) {
+      messageWarning("Failed to write the flexer index: " + path);
+      return;
+    }
+    out.write(reinterpret_cast<const char*>(&header), sizeof(header));
+    out.write(reinterpret_cast<const char*>(files.data()),
+              files.size() * sizeof(InstanceIndex::FileRecord));
+    out.write(reinterpret_cast<const char*>(instances.data()),
+              instances.size() * sizeof(InstanceIndex::InstanceRecord));
+    out.write(strings.data(), strings.size());
+    out.close();
+
+    if (!out || std::rename(tmpPath.c_str(), path.c_str()) != 0) {
+      messageWarning("Failed to write the flexer index: " + path);
+      std::remove(tmpPath.c_str());
+    }
+  }
+
+ private:
+  struct Entry {
+    std::string path;
+    FileStamp stamp;
+    uint64_t contentHash;
+    std::vector<FlexerInstance>::const_iterator beginInstance;
+    std::vector<FlexerInstance>::const_iterator endInstance;
+  };
+
+  static uint64_t appendString(std::string& strings, const std::string& s) {
+    uint64_t offset = strings.size();
+    strings += s;
+    return offset;
+  }
+
+  std::vector<Entry> _entries;
+};
+
+/// @brief Extract all the flexer instances from the given files, scanning
+/// only the files that changed since the last run
+/// @details Files whose size, mtime and inode match the index are not
+/// read. Files whose metadata changed are hashed and rescanned only if
+/// their content changed too. The index is rewritten when anything
+/// changed.
+/// @param indexPath location of the index, created if missing
+/// @param jobs number of threads scanning the files
+inline std::vector<FlexerInstance> extractFlexerInstances(
+    const std::vector<std::string>& filePath, const std::string& indexPath,
+    size_t jobs = clc::jobs) {
+  struct FileState {
+    FileStamp stamp;
+    uint64_t contentHash = 0;
+    size_t nInstances = 0;
+    bool changed = false;
+  };
+
+  std::vector<FileState> states(filePath.size());
+  std::vector<FlexerInstance> instances;
+
+  {
+    InstanceIndex index(indexPath);
+
+    instances = extractFlexerInstancesWith(
+        filePath.size(), jobs, [&](size_t i) {
+          const std::string& path = filePath[i];
+          FileState& state = states[i];
+          messageErrorIf(!stampFile(path, state.stamp),
+                         "Failed to open file: " + path);
+
+          const InstanceIndex::FileRecord* record = index.find(path);
+          std::vector<FlexerInstance> fileInstances;
+          if (record && index.stampOf(*record) == state.stamp) {
+            state.contentHash = record->contentHash;
+            fileInstances = index.instancesOf(*record);
+          } else {
+            state.changed = true;
+            MappedFile file(path);
+            messageErrorIf(!file.isOpen(), "Failed to open file: " + path);
+            state.contentHash = fastHash64(file.data(), file.size());
+            if (record && record->contentHash == state.contentHash) {
+              // touched but not modified
+              fileInstances = index.instancesOf(*record);
+            } else {
+              fileInstances =
+                  extractFlexerInstances(file.begin(), file.end(), path);
+            }
+          }
+          state.nInstances = fileInstances.size();
+          return fileInstances;
+        });
+
+    bool changed = index.size() != filePath.size() ||
+                   std::any_of(states.begin(), states.end(),
+                               [](const FileState& s) { return s.changed; });
+    if (!changed) {
+      return instances;
+    }
+  }
+
+  InstanceIndexWriter writer;
+  auto beginInstance = instances.cbegin();
+  for (size_t i = 0; i < filePath.size(); i++) {
+    auto endInstance = beginInstance + states[i].nInstances;
+    writer.addFile(filePath[i], states[i].stamp, states[i].contentHash,
+                   beginInstance, endInstance);
+    beginInstance = endInstance;
+  }
+  writer.write(indexPath);
+
+  return instances;
+}
+
+}  // namespace flexer
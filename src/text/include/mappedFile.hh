@@ -0,0 +1,68 @@
+#pragma once
+
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include <cstddef>
+#include <string>
+
+namespace flexer {
+
+/// @brief Read-only memory mapping of a whole file, unmapped on
+/// destruction
+class MappedFile {
+ public:
+  explicit MappedFile(const std::string& path) {
+    int fd = ::open(path.c_str(), O_RDONLY | O_CLOEXEC);
+    if (fd < 0) {
+      return;
+    }
+
+    struct stat st;
+    if (::fstat(fd, &st) != 0 || !S_ISREG(st.st_mode)) {
+      ::close(fd);
+      return;
+    }
+
+    _size = static_cast<size_t>(st.st_size);
+    // mmap rejects empty mappings: an empty file is open with no data
+    if (_size > 0) {
+      void* addr = ::mmap(nullptr, _size, PROT_READ, MAP_PRIVATE, fd, 0);
+      if (addr == MAP_FAILED) {
+        ::close(fd);
+        _size = 0;
+        return;
+      }
+      ::madvise(addr, _size, MADV_SEQUENTIAL);
+      _data = static_cast<const char*>(addr);
+    }
+
+    ::close(fd);
+    _open = true;
+  }
+
+  ~MappedFile() {
+    if (_data != nullptr) {
+      ::munmap(const_cast<char*>(_data), _size);
+    }
+  }
+
+  MappedFile(const MappedFile&) = delete;
+  MappedFile& operator=(const MappedFile&) = delete;
+
+  /// @brief true if the file was opened (an empty file is still open)
+  bool isOpen() const { return _open; }
+  const char* data() const { return _data; }
+  size_t size() const { return _size; }
+  const char* begin() const { return _data; }
+  const char* end() const { return _data + _size; }
+
+ private:
+  const char* _data = nullptr;
+  size_t _size = 0;
+  bool _open = false;
+};
+
+}  // namespace flexer
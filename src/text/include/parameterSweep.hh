@@ -0,0 +1,136 @@
+#pragma once
+
+#include <cstdint>
+#include <filesystem>
+#include <string>
+#include <unordered_map>
+#include <utility>
+#include <vector>
+
+#include "FlexerInstance.hh"
+#include "message.hh"
+#include "misc.hh"
+#include "substitution.hh"
+#include "text.hh"
+#include "variantSpace.hh"
+
+namespace flexer {
+
+/// @brief Variants of a project obtained by instantiating the ${NAME}
+/// placeholders of its flexer instances with every combination of the
+/// values of the parameters
+/// @details The space has one region per parameter, whose alternatives are
+/// the values. Only the files with a templated instance are written to the
+/// workspace of a variant.
+class ParameterSweep {
+ public:
+  using Parameters =
+      std::vector<std::pair<std::string, std::vector<std::string>>>;
+
+  ParameterSweep(const std::vector<FlexerInstance>& instances,
+                 const Parameters& parameters) {
+    for (const auto& [name, values] : parameters) {
+      _space.addRegion(name, values);
+    }
+
+    std::unordered_map<std::string, std::vector<FlexerInstance>> templated;
+    for (const auto& instance : instances) {
+      CompiledTemplate compiled(instance.text);
+      if (compiled.parameters().empty()) {
+        continue;
+      }
+      for (const auto& name : compiled.parameters()) {
+        messageErrorIf(regionOf(name) == std::string::npos,
+                       "No values given for parameter '" + name +
+                           "' of flexer instance " + instance.id +
+                           " in " + instance.fileName);
+      }
+      templated[instance.fileName].push_back(instance);
+      _templates.emplace_back(instance.id, std::move(compiled));
+    }
+    // keep the order of the lines of each file
+    for (auto& [fileName, fileInstances] : organizeInstances(instances)) {
+      if (templated.count(fileName)) {
+        _toBeSubstituted.emplace(fileName, std::move(fileInstances));
+      }
+    }
+  }
+
+  const VariantSpace& space() const { return _space; }
+
+  /// @brief files written by materialize
+  const std::unordered_map<std::string, std::vector<FlexerInstance>>&
+  files() const {
+    return _toBeSubstituted;
+  }
+
+  /// @brief FLEXER_PARAM_<NAME>=<value> for each parameter of the variant
+  std::vector<std::string> environment(uint64_t index) const {
+    Variant variant = _space.at(index);
+    std::vector<std::string> env;
+    env.reserve(_space.regions().size());
+    for (size_t i = 0; i < _space.regions().size(); i++) {
+      env.push_back("FLEXER_PARAM_" + _space.regions()[i].id + "=" +
+                    std::string(variant.textOf(i)));
+    }
+    return env;
+  }
+
+  /// @brief write the substituted files of the variant to workspace, at
+  /// their path relative to projectRoot; a file that already has the
+  /// content of the variant is left untouched, so that incremental builds
+  /// in a reused workspace skip it
+  /// @return the number of files written
+  size_t materialize(uint64_t index, const std::string& projectRoot,
+                     const std::string& workspace) const {
+    Variant variant = _space.at(index);
+    std::vector<std::string_view> values(_space.regions().size());
+    for (size_t i = 0; i < values.size(); i++) {
+      values[i] = variant.textOf(i);
+    }
+
+    std::unordered_map<std::string, std::string> textById;
+    for (const auto& [id, compiled] : _templates) {
+      std::vector<std::string_view> bySlot;
+      bySlot.reserve(compiled.parameters().size());
+      for (const auto& name : compiled.parameters()) {
+        bySlot.push_back(values[regionOf(name)]);
+      }
+      compiled.instantiate(bySlot, textById[id]);
+    }
+
+    auto plan = planSubstitutions(_toBeSubstituted, textById);
+    size_t written = 0;
+    for (const auto& [fileName, filePlan] : plan) {
+      auto destPath =
+          std::filesystem::path(workspace) /
+          std::filesystem::relative(fileName, projectRoot);
+      std::error_code ec;
+      std::filesystem::create_directories(destPath.parent_path(), ec);
+      messageErrorIf(ec, "Failed to create directory " +
+                             destPath.parent_path().string() + ": " +
+                             ec.message());
+      written += writeSubstitutedFile(fileName, filePlan, destPath.string(),
+                                      true);
+    }
+    return written;
+  }
+
+ private:
+  size_t regionOf(const std::string& name) const {
+    const auto& regions = _space.regions();
+    for (size_t i = 0; i < regions.size(); i++) {
+      if (regions[i].id == name) {
+        return i;
+      }
+    }
+    return std::string::npos;
+  }
+
+  VariantSpace _space;
+  std::vector<std::pair<std::string, CompiledTemplate>> _templates;
+  std::unordered_map<std::string, std::vector<FlexerInstance>>
+      _toBeSubstituted;
+};
+
+}  // namespace flexer
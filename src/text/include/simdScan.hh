@@ -0,0 +1,105 @@
+#pragma once
+
+#include <cstddef>
+#include <cstring>
+
+#if defined(__AVX2__) || defined(__SSE2__)
+#include <immintrin.h>
+#endif
+
+namespace flexer {
+namespace simd {
+
+/// @brief Return a pointer to the first occurrence of c in [begin, end),
+/// or end if c does not occur
+inline const char* findByte(const char* begin, const char* end, char c) {
+  const char* p = begin;
+#if defined(__AVX2__)
+  const __m256i needle = _mm256_set1_epi8(c);
+  for (; p + 32 <= end; p += 32) {
+    __m256i chunk = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(p));
+    unsigned mask = static_cast<unsigned>(
+        _mm256_movemask_epi8(_mm256_cmpeq_epi8(chunk, needle)));
+    if (mask != 0) {
+      return p + __builtin_ctz(mask);
+    }
+  }
+#endif
+#if defined(__SSE2__)
+  const __m128i needle16 = _mm_set1_epi8(c);
+  for (; p + 16 <= end; p += 16) {
+    __m128i chunk = _mm_loadu_si128(reinterpret_cast<const __m128i*>(p));
+    unsigned mask = static_cast<unsigned>(
+        _mm_movemask_epi8(_mm_cmpeq_epi8(chunk, needle16)));
+    if (mask != 0) {
+      return p + __builtin_ctz(mask);
+    }
+  }
+#endif
+  // scalar tail (or the whole range without SIMD support)
+  if (p >= end) {
+    return end;
+  }
+  const void* found = std::memchr(p, c, static_cast<size_t>(end - p));
+  return found ? static_cast<const char*>(found) : end;
+}
+
+/// @brief Count the occurrences of c in [begin, end)
+inline size_t countByte(const char* begin, const char* end, char c) {
+  size_t count = 0;
+  const char* p = begin;
+#if defined(__AVX2__)
+  const __m256i needle = _mm256_set1_epi8(c);
+  for (; p + 32 <= end; p += 32) {
+    __m256i chunk = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(p));
+    count += static_cast<size_t>(__builtin_popcount(static_cast<unsigned>(
+        _mm256_movemask_epi8(_mm256_cmpeq_epi8(chunk, needle)))));
+  }
+#endif
+#if defined(__SSE2__)
+  const __m128i needle16 = _mm_set1_epi8(c);
+  for (; p + 16 <= end; p += 16) {
+    __m128i chunk = _mm_loadu_si128(reinterpret_cast<const __m128i*>(p));
+    count += static_cast<size_t>(__builtin_popcount(static_cast<unsigned>(
+        _mm_movemask_epi8(_mm_cmpeq_epi8(chunk, needle16)))));
+  }
+#endif
+  for (; p < end; ++p) {
+    count += (*p == c);
+  }
+  return count;
+}
+
+/// @brief Return a pointer to the last occurrence of c in [begin, end),
+/// or nullptr if c does not occur
+inline const char* findLastByte(const char* begin, const char* end,
+                                char c) {
+  if (begin >= end) {
+    return nullptr;
+  }
+  const void* found = ::memrchr(begin, c, static_cast<size_t>(end - begin));
+  return static_cast<const char*>(found);
+}
+
+}  // namespace simd
+
+/// @brief Computes 1-based line numbers of increasing positions in a
+/// buffer by counting newlines only over the not yet visited range
+class LazyLineCounter {
+ public:
+  explicit LazyLineCounter(const char* begin) : _pos(begin) {}
+
+  /// @brief line number of position p; p must not precede the position
+  /// of the previous query
+  size_t lineOf(const char* p) {
+    _line += simd::countByte(_pos, p, '\n');
+    _pos = p;
+    return _line;
+  }
+
+ private:
+  const char* _pos;
+  size_t _line = 1;
+};
+
+}  // namespace flexer
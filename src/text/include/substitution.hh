@@ -0,0 +1,265 @@
+#pragma once
+
+#include <fcntl.h>
+#include <limits.h>
+#include <sys/stat.h>
+#include <sys/uio.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <atomic>
+#include <cerrno>
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+#include <string>
+#include <string_view>
+#include <vector>
+
+#include "FlexerInstance.hh"
+#include "FlexerSpan.hh"
+#include "mappedFile.hh"
+#include "message.hh"
+#include "profiler.hh"
+#include "simdScan.hh"
+#include "text.hh"
+
+namespace flexer {
+
+/// @brief Replacement of the bytes [begin, end) of a file with text
+struct Splice {
+  size_t begin;
+  size_t end;
+  std::string_view text;
+};
+
+/// @brief Finds the byte offset of increasing line numbers in a buffer,
+/// scanning every byte at most once
+class LineLocator {
+ public:
+  LineLocator(const char* begin, const char* end)
+      : _begin(begin), _end(end), _pos(begin) {}
+
+  /// @brief offset of the first byte of the 1-based line, the size of the
+  /// buffer if the line starts at its end, npos if the buffer has fewer
+  /// lines; line must not precede the line of the previous query
+  size_t offsetOf(size_t line) {
+    while (_line < line) {
+      if (_pos == _end) {
+        return std::string::npos;
+      }
+      const char* newline = simd::findByte(_pos, _end, '\n');
+      _pos = newline == _end ? _end : newline + 1;
+      if (newline == _end) {
+        // last line without a trailing newline
+        return std::string::npos;
+      }
+      ++_line;
+    }
+    return static_cast<size_t>(_pos - _begin);
+  }
+
+ private:
+  const char* _begin;
+  const char* _end;
+  const char* _pos;
+  size_t _line = 1;
+};
+
+/// @brief True if the file at path is the concatenation of the chunks
+inline bool fileHoldsChunks(const std::vector<struct iovec>& chunks,
+                            const std::string& path) {
+  MappedFile file(path);
+  if (!file.isOpen()) {
+    return false;
+  }
+  size_t size = 0;
+  for (const auto& chunk : chunks) {
+    size += chunk.iov_len;
+  }
+  if (size != file.size()) {
+    return false;
+  }
+  const char* pos = file.data();
+  for (const auto& chunk : chunks) {
+    if (std::memcmp(pos, chunk.iov_base, chunk.iov_len) != 0) {
+      return false;
+    }
+    pos += chunk.iov_len;
+  }
+  return true;
+}
+
+/// @brief Write data with the splices applied to destPath using vectored
+/// writes: the unchanged chunks of data and the replacement texts are
+/// passed to writev as they are, the result is never assembled in memory
+/// @details The file is written next to destPath and renamed over it, so
+/// destPath can be the file data is mapped from
+/// @param splices sorted and non-overlapping
+/// @param onlyIfChanged leave destPath untouched, mtime included, if it
+/// already has the substituted content, so that incremental builds skip it
+/// @param modeSource file whose permissions the written file gets, such as
+/// the file data comes from; destPath if empty, a new file then gets the
+/// default permissions
+/// @return false if destPath was left untouched
+inline bool writeSpliced(const char* data, size_t size,
+                         const std::vector<Splice>& splices,
+                         const std::string& destPath,
+                         bool onlyIfChanged = false,
+                         const std::string& modeSource = "") {
+  FLEXER_PROFILE_SCOPE("write substituted file");
+  std::vector<struct iovec> chunks;
+  chunks.reserve(splices.size() * 2 + 1);
+  auto addChunk = [&chunks](const char* base, size_t length) {
+    if (length > 0) {
+      chunks.push_back({const_cast<char*>(base), length});
+    }
+  };
+
+  size_t copied = 0;
+  for (const auto& splice : splices) {
+    messageErrorIf(splice.begin < copied || splice.end < splice.begin ||
+                       splice.end > size,
+                   "Overlapping or out of range substitution in: " + destPath);
+    addChunk(data + copied, splice.begin - copied);
+    addChunk(splice.text.data(), splice.text.size());
+    copied = splice.end;
+  }
+  addChunk(data + copied, size - copied);
+
+  if (onlyIfChanged && fileHoldsChunks(chunks, destPath)) {
+    return false;
+  }
+
+  // unique per process and per call: concurrent writers of destPath must
+  // not truncate or rename each other's temporary file
+  static std::atomic<uint64_t> tmpCounter{0};
+  std::string tmpPath = destPath + ".flexer.tmp." + std::to_string(getpid()) +
+                        "." + std::to_string(tmpCounter++);
+  int fd = ::open(tmpPath.c_str(), O_WRONLY | O_CREAT | O_EXCL | O_CLOEXEC,
+                  0666);
+  messageErrorIf(fd < 0, "Failed to open file for writing: " + tmpPath +
+                             " (" + std::strerror(errno) + ")");
+  // the rename would replace the permissions of destPath, such as the
+  // exec bit of a script, with the default ones
+  struct stat st;
+  if (::stat(modeSource.empty() ? destPath.c_str() : modeSource.c_str(),
+             &st) == 0) {
+    ::fchmod(fd, st.st_mode & 07777);
+  }
+
+  size_t next = 0;
+  while (next < chunks.size()) {
+    int count =
+        static_cast<int>(std::min<size_t>(IOV_MAX, chunks.size() - next));
+    ssize_t written = ::writev(fd, chunks.data() + next, count);
+    if (written < 0) {
+      if (errno == EINTR) {
+        continue;
+      }
+      ::close(fd);
+      std::remove(tmpPath.c_str());
+      messageError("Failed to write file: " + tmpPath + " (" +
+                   std::strerror(errno) + ")");
+    }
+    // skip the chunks fully written, advance into a partially written one
+    size_t left = static_cast<size_t>(written);
+    while (next < chunks.size() && left >= chunks[next].iov_len) {
+      left -= chunks[next].iov_len;
+      ++next;
+    }
+    if (left > 0) {
+      chunks[next].iov_base = static_cast<char*>(chunks[next].iov_base) + left;
+      chunks[next].iov_len -= left;
+    }
+  }
+
+  bool failed = ::close(fd) != 0;
+  failed = failed || std::rename(tmpPath.c_str(), destPath.c_str()) != 0;
+  if (failed) {
+    std::remove(tmpPath.c_str());
+    messageError("Failed to write file: " + destPath + " (" +
+                 std::strerror(errno) + ")");
+  }
+  return true;
+}
+
+/// @brief Write the content of buffer to destPath with the given splices
+/// applied, typically built from the spans of FlexerInstanceView
+inline void writeSubstitutedFile(const FileBuffer& buffer,
+                                 std::vector<Splice> splices,
+                                 const std::string& destPath) {
+  std::sort(splices.begin(), splices.end(),
+            [](const Splice& a, const Splice& b) { return a.begin < b.begin; });
+  writeSpliced(buffer->data(), buffer->size(), splices, destPath);
+}
+
+/// @brief Write fileName to destPath replacing the lines [startLine,
+/// endLine] of the instance of each substitution with its text
+/// @param substitutions sorted by startLine; instanceOf and textOf return the
+/// instance and the replacement text of a substitution
+/// @return false if destPath was left untouched, see writeSpliced
+template <typename Substitution, typename InstanceOf, typename TextOf>
+inline bool writeLineSubstitutions(
+    const std::string& fileName,
+    const std::vector<Substitution>& substitutions,
+    const InstanceOf& instanceOf, const TextOf& textOf,
+    const std::string& destPath, bool onlyIfChanged = false) {
+  MappedFile file(fileName);
+  messageErrorIf(!file.isOpen(), "Failed to open file: " + fileName);
+
+  LineLocator lines(file.begin(), file.end());
+  std::vector<Splice> splices;
+  splices.reserve(substitutions.size());
+  for (const auto& substitution : substitutions) {
+    const FlexerInstance& instance = instanceOf(substitution);
+    messageErrorIf(instance.fileName != fileName,
+                   "Flexer subInstances from different files provided");
+    size_t begin = lines.offsetOf(instance.startLine);
+    size_t end = lines.offsetOf(instance.endLine + 1);
+    messageErrorIf(
+        begin == std::string::npos || end == std::string::npos,
+        "Not all flexer subInstances were substituted in file: " + fileName);
+    splices.push_back({begin, end, textOf(substitution)});
+  }
+
+  return writeSpliced(file.data(), file.size(), splices, destPath,
+                      onlyIfChanged, fileName);
+}
+
+/// @brief Write fileName to destPath with the text of each of the
+/// subInstances replacing the lines [startLine, endLine] of the file
+/// @param subInstances instances of fileName sorted by startLine, as
+/// returned by organizeInstances
+inline void writeSubstitutedFile(
+    const std::string& fileName,
+    const std::vector<FlexerInstance>& subInstances,
+    const std::string& destPath) {
+  writeLineSubstitutions(
+      fileName, subInstances,
+      [](const FlexerInstance& instance) -> const FlexerInstance& {
+        return instance;
+      },
+      [](const FlexerInstance& instance) {
+        return std::string_view(instance.text);
+      },
+      destPath);
+}
+
+/// @brief Write fileName to destPath applying its substitution plan
+/// @param filePlan the plan of fileName, as returned by planSubstitutions
+/// @return false if destPath was left untouched, see writeSpliced
+inline bool writeSubstitutedFile(
+    const std::string& fileName,
+    const std::vector<PlannedSubstitution>& filePlan,
+    const std::string& destPath, bool onlyIfChanged = false) {
+  return writeLineSubstitutions(
+      fileName, filePlan,
+      [](const PlannedSubstitution& planned) -> const FlexerInstance& {
+        return *planned.instance;
+      },
+      [](const PlannedSubstitution& planned) { return planned.text; },
+      destPath, onlyIfChanged);
+}
+
+}  // namespace flexer
@@ -1,46 +1,76 @@
 #pragma once
 
 #include <algorithm>
+#include <array>
+#include <atomic>
 #include <csignal>
 #include <filesystem>
 #include <fstream>
 #include <iostream>
+#include <iterator>
+#include <mutex>
 #include <ostream>
 #include <sstream>
 #include <string>
+#include <string_view>
+#include <tuple>
 #include <unordered_map>
 #include <utility>
 #include <vector>
 
 #include "FlexerInstance.hh"
+#include "FlexerSpan.hh"
 #include "globals.hh"
+#include "mappedFile.hh"
 #include "message.hh"
+#include "profiler.hh"
+#include "simdScan.hh"
+#include "threadPool.hh"
 
 namespace flexer {
 
-/// @brief Extract all the flexer instances from the given file
-inline std::vector<FlexerInstance> extractFlexerInstances(
-    const std::string& filePath) {
-  std::vector<FlexerInstance> flexerInstances;
-
-  // Read the content of the file
-  std::ifstream file(filePath);
-  if (!file.is_open()) {
-    messageError("Failed to open file: " + filePath);
-    return flexerInstances;
-  }
-
-  const std::string startTag = "@start-flexer";
-  const std::string endTag = "@end-flexer";
-  std::string line;
-  std::string id;
-  std::string text;
+/// @brief Locate all the flexer instances in the content of a file
+/// @details Only the lines containing an '@' candidate are inspected; line
+/// numbers are computed lazily by counting the newlines between
+/// consecutive tags
+/// @param filePath name of the file, used for the errors
+/// @return the spans of the instances, offsets are relative to fileBegin
+/// and the file handle is left to the caller
+inline std::vector<FlexerSpan> scanFlexerSpans(const char* fileBegin,
+                                               const char* fileEnd,
+                                               const std::string& filePath) {
+  FLEXER_PROFILE_SCOPE("scan file");
+  std::vector<FlexerSpan> spans;
+
+  const std::string_view startTag = "@start-flexer";
+  const std::string_view endTag = "@end-flexer";
+  LazyLineCounter lineCounter(fileBegin);
+
+  // offsets of the ID of the current flexer instance
+  size_t idBegin = 0;
+  size_t idEnd = 0;
   bool insideFlexer = false;
-  size_t currLineNumber = 0;
   size_t startTagLineNumber = 0;
+  // first byte of the text enclosed by the current flexer instance
+  const char* textBegin = nullptr;
+
+  const char* cursor = fileBegin;
+  while ((cursor = simd::findByte(cursor, fileEnd, '@')) != fileEnd) {
+    std::string_view candidate(cursor, fileEnd - cursor);
+    if (candidate.compare(0, startTag.size(), startTag) != 0 &&
+        candidate.compare(0, endTag.size(), endTag) != 0) {
+      ++cursor;
+      continue;
+    }
 
-  while (std::getline(file, line)) {
-    ++currLineNumber;
+    // isolate the line containing the tag
+    const char* lineBegin = simd::findLastByte(fileBegin, cursor, '\n');
+    lineBegin = lineBegin ? lineBegin + 1 : fileBegin;
+    const char* lineEnd = simd::findByte(cursor, fileEnd, '\n');
+    std::string_view line(lineBegin, lineEnd - lineBegin);
+    size_t currLineNumber = lineCounter.lineOf(lineBegin);
+    // the next candidate can only be on the following line
+    cursor = lineEnd == fileEnd ? fileEnd : lineEnd + 1;
 
     size_t startIdx = line.find(startTag);
     size_t endIdx = line.find(endTag);
@@ -58,16 +88,11 @@ inline std::vector<FlexerInstance> extractFlexerInstances(
                    "@start-flexer at line " +
                        std::to_string(currLineNumber) +
                        " in file: " + filePath);
-    messageErrorIf(!insideFlexer && endIdx != std::string::npos,
-                   "Unexpected end tag found at line " +
-                       std::to_string(currLineNumber) +
-                       " in file: " + filePath);
 
     if (startIdx != std::string::npos) {
       insideFlexer = true;
-      id.clear();
-      text.clear();
       startTagLineNumber = currLineNumber + 1;
+      textBegin = cursor;
 
       size_t idStartIdx = line.find('[');
       size_t idEndIdx = line.find(']');
@@ -75,24 +100,23 @@ inline std::vector<FlexerInstance> extractFlexerInstances(
           idEndIdx == std::string::npos || idStartIdx == std::string::npos,
           "Error when parsing flexer ID at line " +
               std::to_string(currLineNumber) + " in file: " + filePath);
-      id = line.substr(idStartIdx + 1, idEndIdx - idStartIdx - 1);
+      std::string_view id =
+          line.substr(idStartIdx + 1, idEndIdx - idStartIdx - 1);
+      idBegin = static_cast<size_t>(id.data() - fileBegin);
+      idEnd = idBegin + id.size();
       messageErrorIf(id.empty(), "Empty flexer ID found at line " +
                                      std::to_string(currLineNumber) +
                                      " in file: " + filePath);
-
       continue;
     }
 
-    if (endIdx != std::string::npos && insideFlexer) {
-      flexerInstances.push_back(
-          {id, text, startTagLineNumber, currLineNumber - 1, filePath});
-      insideFlexer = false;
-      continue;
-    }
-
-    if (insideFlexer) {
-      text += line + "\n";
-    }
+    // end tag closing the current instance: the enclosed text is every
+    // full line between the two tags, newlines included
+    spans.push_back({0, idBegin, idEnd,
+                     static_cast<size_t>(textBegin - fileBegin),
+                     static_cast<size_t>(lineBegin - fileBegin),
+                     startTagLineNumber, currLineNumber - 1});
+    insideFlexer = false;
   }
 
   // Check for an incomplete flexer instance at the end of the file
@@ -101,44 +125,228 @@ inline std::vector<FlexerInstance> extractFlexerInstances(
       "Unmatched end tag after reaching the end of the file in file: " +
           filePath);
 
-  return flexerInstances;
+  return spans;
 }
 
-///@brief Extract all the flexer instances from the given files
+/// @brief Extract all the flexer instances from the content of a file
+/// @param filePath name of the file, used for the instances and errors
 inline std::vector<FlexerInstance> extractFlexerInstances(
-    const std::vector<std::string>& filePath) {
+    const char* fileBegin, const char* fileEnd, const std::string& filePath) {
   std::vector<FlexerInstance> flexerInstances;
-  for (const auto& file : filePath) {
-    auto instances = extractFlexerInstances(file);
-    flexerInstances.insert(flexerInstances.end(), instances.begin(),
-                           instances.end());
+  for (const auto& span : scanFlexerSpans(fileBegin, fileEnd, filePath)) {
+    flexerInstances.push_back(
+        {std::string(fileBegin + span.idBegin, fileBegin + span.idEnd),
+         std::string(fileBegin + span.textBegin, fileBegin + span.textEnd),
+         span.startLine, span.endLine, filePath});
   }
+  return flexerInstances;
+}
 
-  std::unordered_map<std::string, size_t> occurrences;
+/// @brief Extract all the flexer instances from the given file
+/// @details The file is memory mapped and scanned in place
+inline std::vector<FlexerInstance> extractFlexerInstances(
+    const std::string& filePath) {
+  MappedFile file(filePath);
+  if (!file.isOpen()) {
+    messageError("Failed to open file: " + filePath);
+    return {};
+  }
+  return extractFlexerInstances(file.begin(), file.end(), filePath);
+}
+
+///@brief Thread-safe occurrence counter of flexer IDs, split into
+/// independently locked shards to keep contention low
+///@details The IDs are not copied: the counter keeps the views, whose
+/// characters must outlive it
+class IdOccurrences {
+ public:
+  ///@brief count one more occurrence of id, return true if id was already
+  /// seen
+  bool add(std::string_view id) {
+    auto& shard = _shards[std::hash<std::string_view>{}(id) % nShards];
+    std::lock_guard<std::mutex> lock{shard.guard};
+    return ++shard.occurrences[id] > 1;
+  }
 
-  bool duplicateIdsFound = false;
-  for (const auto& instance : flexerInstances) {
-    occurrences[instance.id]++;
-    if (occurrences.at(instance.id) > 1) {
-      duplicateIdsFound = true;
+  size_t count(std::string_view id) const {
+    const auto& shard = _shards[std::hash<std::string_view>{}(id) % nShards];
+    std::lock_guard<std::mutex> lock{shard.guard};
+    auto it = shard.occurrences.find(id);
+    return it == shard.occurrences.end() ? 0 : it->second;
+  }
+
+ private:
+  static constexpr size_t nShards = 64;
+  struct Shard {
+    mutable std::mutex guard;
+    std::unordered_map<std::string_view, size_t> occurrences;
+  };
+  std::array<Shard, nShards> _shards;
+};
+
+inline std::string_view instanceId(const FlexerInstance& instance) {
+  return instance.id;
+}
+
+inline std::string_view instanceId(const FlexerInstanceView& instance) {
+  return instance.id();
+}
+
+///@brief Exit with an error listing the instances sharing an ID, sorted by
+/// file and line
+inline void reportDuplicateIds(std::vector<FlexerInstance> duplicates) {
+  std::sort(duplicates.begin(), duplicates.end(),
+            [](const FlexerInstance& a, const FlexerInstance& b) {
+              return std::tie(a.fileName, a.startLine) <
+                     std::tie(b.fileName, b.startLine);
+            });
+
+  std::string duplicateIdsStr = "\n";
+  for (const auto& instance : duplicates) {
+    duplicateIdsStr += "\t" + instance.id + " found in file:\n";
+    duplicateIdsStr += "\t\t" + instance.fileName + " " + "lines " +
+                       std::to_string(instance.startLine) + " to " +
+                       std::to_string(instance.endLine) + "\n";
+    duplicateIdsStr += "\n";
+  }
+  messageError("Duplicate flexer IDs found: " + duplicateIdsStr);
+}
+
+///@brief Run scanFile(fileIndex) over all the files and merge the
+/// instances it returns, checking that all IDs are unique
+///@param jobs number of threads scanning the files; with more than one
+/// thread the files are sharded across a work-stealing pool. The result
+/// is in the order of the files regardless of the number of threads
+///@param toInstance converts an Instance to a FlexerInstance to report
+/// duplicated IDs
+template <typename Instance, typename ScanFile, typename ToInstance>
+inline std::vector<Instance> extractInstancesWith(
+    size_t nFiles, size_t jobs, const ScanFile& scanFile,
+    const ToInstance& toInstance) {
+  FLEXER_PROFILE_SCOPE("extract instances");
+  // one slot per file, merged once at the end; the slots are not modified
+  // before the merge, so occurrences can keep views of their IDs
+  std::vector<std::vector<Instance>> perFileInstances(nFiles);
+  IdOccurrences occurrences;
+  std::atomic<bool> duplicateIdsFound{false};
+
+  auto scanAndCount = [&](size_t fileIndex) {
+    auto& instances = perFileInstances[fileIndex];
+    instances = scanFile(fileIndex);
+    for (const auto& instance : instances) {
+      if (occurrences.add(instanceId(instance))) {
+        duplicateIdsFound.store(true, std::memory_order_relaxed);
+      }
+    }
+  };
+
+  jobs = std::min(jobs, nFiles);
+  if (jobs <= 1) {
+    for (size_t i = 0; i < nFiles; i++) {
+      scanAndCount(i);
     }
+  } else {
+    // a few shards per worker leave room for stealing when files differ
+    // in size
+    const size_t shardSize = std::max<size_t>(1, nFiles / (jobs * 8));
+    WorkStealingPool pool(jobs);
+    for (size_t begin = 0; begin < nFiles; begin += shardSize) {
+      size_t end = std::min(begin + shardSize, nFiles);
+      pool.submit([&scanAndCount, begin, end] {
+        for (size_t i = begin; i < end; i++) {
+          scanAndCount(i);
+        }
+      });
+    }
+    pool.wait();
   }
 
+  // before the merge moves the IDs the views point to
   if (duplicateIdsFound) {
-    std::string duplicateIdsStr = "\n";
-    for (const auto& instance : flexerInstances) {
-      if (occurrences.at(instance.id) > 1) {
-        duplicateIdsStr += "\t" + instance.id + " found in file:\n";
-        duplicateIdsStr += "\t\t" + instance.fileName + " " + "lines " +
-                           std::to_string(instance.startLine) + " to " +
-                           std::to_string(instance.endLine) + "\n";
-        duplicateIdsStr += "\n";
+    std::vector<FlexerInstance> duplicates;
+    for (const auto& instances : perFileInstances) {
+      for (const auto& instance : instances) {
+        if (occurrences.count(instanceId(instance)) > 1) {
+          duplicates.push_back(toInstance(instance));
+        }
       }
     }
-    messageError("Duplicate flexer IDs found: " + duplicateIdsStr);
+    reportDuplicateIds(std::move(duplicates));
   }
 
-  return flexerInstances;
+  size_t nInstances = 0;
+  for (const auto& instances : perFileInstances) {
+    nInstances += instances.size();
+  }
+  std::vector<Instance> result;
+  result.reserve(nInstances);
+  for (auto& instances : perFileInstances) {
+    std::move(instances.begin(), instances.end(),
+              std::back_inserter(result));
+  }
+
+  return result;
+}
+
+///@brief extractInstancesWith for scanners returning FlexerInstance
+template <typename ScanFile>
+inline std::vector<FlexerInstance> extractFlexerInstancesWith(
+    size_t nFiles, size_t jobs, const ScanFile& scanFile) {
+  return extractInstancesWith<FlexerInstance>(
+      nFiles, jobs, scanFile,
+      [](const FlexerInstance& instance) { return instance; });
+}
+
+///@brief Extract all the flexer instances from the given files
+///@param jobs number of threads scanning the files
+inline std::vector<FlexerInstance> extractFlexerInstances(
+    const std::vector<std::string>& filePath, size_t jobs = clc::jobs) {
+  return extractFlexerInstancesWith(
+      filePath.size(), jobs,
+      [&filePath](size_t i) { return extractFlexerInstances(filePath[i]); });
+}
+
+///@brief Extract zero-copy views on the flexer instances of the given file
+///@details The file stays mapped as long as one of the views is alive; a
+/// file without instances is unmapped right away
+inline std::vector<FlexerInstanceView> extractFlexerInstanceViews(
+    const std::string& filePath, FileNameTable& fileNames) {
+  auto file = std::make_shared<const MappedFile>(filePath);
+  if (!file->isOpen()) {
+    messageError("Failed to open file: " + filePath);
+    return {};
+  }
+
+  std::vector<FlexerSpan> spans =
+      scanFlexerSpans(file->begin(), file->end(), filePath);
+  std::vector<FlexerInstanceView> views;
+  if (spans.empty()) {
+    return views;
+  }
+
+  FileNameTable::Handle handle = fileNames.intern(filePath);
+  views.reserve(spans.size());
+  for (auto& span : spans) {
+    span.file = handle;
+    views.push_back({file, span});
+  }
+  return views;
+}
+
+///@brief Extract zero-copy views on the flexer instances of the given files
+///@param fileNames table interning the names of the files with instances
+///@param jobs number of threads scanning the files
+inline std::vector<FlexerInstanceView> extractFlexerInstanceViews(
+    const std::vector<std::string>& filePath, FileNameTable& fileNames,
+    size_t jobs = clc::jobs) {
+  return extractInstancesWith<FlexerInstanceView>(
+      filePath.size(), jobs,
+      [&](size_t i) {
+        return extractFlexerInstanceViews(filePath[i], fileNames);
+      },
+      [&fileNames](const FlexerInstanceView& view) {
+        return view.toInstance(fileNames);
+      });
 }
 
 ///@brief Organize the flexer instances by file
@@ -216,49 +424,120 @@ inline std::string subtituteFlexerInstances(
   return result.str();
 }
 
+///@brief Index the instances by ID; with repeated IDs the first instance
+/// is kept
+inline std::unordered_map<std::string_view, const FlexerInstance*>
+indexInstancesById(const std::vector<FlexerInstance>& instances) {
+  std::unordered_map<std::string_view, const FlexerInstance*> index;
+  index.reserve(instances.size());
+  for (const auto& instance : instances) {
+    index.emplace(instance.id, &instance);
+  }
+  return index;
+}
+
+///@brief For each file, the instances to be substituted with the text of
+/// the substitution sharing their ID, if any
 inline std::unordered_map<std::string, std::vector<FlexerInstance>>
 generateSubInstances(
     const std::unordered_map<std::string, std::vector<FlexerInstance>>&
         toBeSubstituted,
     const std::unordered_map<std::string, std::vector<FlexerInstance>>&
         subtitutions) {
+  FLEXER_PROFILE_SCOPE("generate substitutions");
   std::unordered_map<std::string, std::vector<FlexerInstance>> resultMap;
+  resultMap.reserve(toBeSubstituted.size());
 
   for (const auto& [fileName, instances] : toBeSubstituted) {
-    // initialize the result map
-    resultMap[fileName];
+    // initialize the result map with the original instances
+    auto& subInstances = resultMap[fileName] = instances;
     // if the file has subtitutions
-    if (subtitutions.count(fileName)) {
-      // get the subtitutions for the file
-      auto& subInstances = subtitutions.at(fileName);
-      // for each instance potentially to be substituted
-      for (const auto& tbsInstance : instances) {
-        // find if the instance has a subtitution
-        auto last =
-            std::find_if(subInstances.begin(), subInstances.end(),
-                         [&tbsInstance](const FlexerInstance& subInstance) {
-                           return subInstance.id == tbsInstance.id;
-                         });
-
-        if (last != subInstances.end()) {
-          // if the instance has a subtitution, load the subtitution text
-          resultMap[fileName].push_back(tbsInstance);
-          resultMap.at(fileName).back().text = last->text;
-
-        } else {
-          // if the instance does not have a subtitution, keep the original text
-          resultMap[fileName].push_back(tbsInstance);
-        }
+    auto fileSubs = subtitutions.find(fileName);
+    if (fileSubs == subtitutions.end()) {
+      continue;
+    }
+    // load the text of the instances having a subtitution
+    auto subById = indexInstancesById(fileSubs->second);
+    for (auto& instance : subInstances) {
+      auto sub = subById.find(instance.id);
+      if (sub != subById.end()) {
+        instance.text = sub->second->text;
       }
-    } else {
-      // if the file does not have subtitutions, fill with the original
-      // instances
-      resultMap[fileName] = instances;
     }
   }
 
   return resultMap;
 }
 
+///@brief Same as generateSubInstances, but the instances are moved out of
+/// toBeSubstituted and only the substituted texts are copied
+inline std::unordered_map<std::string, std::vector<FlexerInstance>>
+generateSubInstances(
+    std::unordered_map<std::string, std::vector<FlexerInstance>>&&
+        toBeSubstituted,
+    const std::unordered_map<std::string, std::vector<FlexerInstance>>&
+        subtitutions) {
+  FLEXER_PROFILE_SCOPE("generate substitutions");
+  std::unordered_map<std::string, std::vector<FlexerInstance>> resultMap =
+      std::move(toBeSubstituted);
+
+  for (auto& [fileName, instances] : resultMap) {
+    auto fileSubs = subtitutions.find(fileName);
+    if (fileSubs == subtitutions.end()) {
+      continue;
+    }
+    auto subById = indexInstancesById(fileSubs->second);
+    for (auto& instance : instances) {
+      auto sub = subById.find(instance.id);
+      if (sub != subById.end()) {
+        instance.text = sub->second->text;
+      }
+    }
+  }
+
+  return resultMap;
+}
+
+///@brief Instance of a substitution plan: the original instance and the
+/// text replacing it, both owned by the caller
+struct PlannedSubstitution {
+  const FlexerInstance* instance;
+  std::string_view text;
+};
+
+///@brief For each file, the substitution of its instances, in the order of
+/// toBeSubstituted
+using SubstitutionPlan =
+    std::unordered_map<std::string, std::vector<PlannedSubstitution>>;
+
+///@brief Plan the substitution of the instances with the texts given by ID;
+/// instances without a text keep their original one
+///@details Nothing is copied: the plan points into toBeSubstituted and
+/// textById, which must outlive it
+///@param textById map from ID to text, such as
+/// std::unordered_map<std::string, std::string> or the map filled by
+/// Variant::textById
+template <typename TextById>
+inline SubstitutionPlan planSubstitutions(
+    const std::unordered_map<std::string, std::vector<FlexerInstance>>&
+        toBeSubstituted,
+    const TextById& textById) {
+  FLEXER_PROFILE_SCOPE("plan substitutions");
+  SubstitutionPlan plan;
+  plan.reserve(toBeSubstituted.size());
+
+  for (const auto& [fileName, instances] : toBeSubstituted) {
+    auto& filePlan = plan[fileName];
+    filePlan.reserve(instances.size());
+    for (const auto& instance : instances) {
+      auto text = textById.find(instance.id);
+      filePlan.push_back({&instance, text != textById.end()
+                                         ? std::string_view(text->second)
+                                         : std::string_view(instance.text)});
+    }
+  }
+
+  return plan;
+}
 
 }  // namespace flexer
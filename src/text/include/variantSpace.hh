@@ -0,0 +1,177 @@
+#pragma once
+
+#include <cstdint>
+#include <iterator>
+#include <string>
+#include <string_view>
+#include <unordered_map>
+#include <utility>
+#include <vector>
+
+#include "message.hh"
+
+namespace flexer {
+
+class VariantSpace;
+
+/// @brief Point of a variant space: the alternative chosen for each region
+class Variant {
+ public:
+  Variant(const VariantSpace* space, uint64_t index,
+          std::vector<uint32_t> choices)
+      : _space(space), _index(index), _choices(std::move(choices)) {}
+
+  /// @brief position of the variant in the enumeration of the space
+  uint64_t index() const { return _index; }
+
+  /// @brief index of the alternative chosen for the given region
+  uint32_t choiceOf(size_t region) const { return _choices[region]; }
+
+  const std::vector<uint32_t>& choices() const { return _choices; }
+
+  /// @brief text of the alternative chosen for the given region
+  inline std::string_view textOf(size_t region) const;
+
+  /// @brief fill textById with the chosen text of every region, as
+  /// expected by planSubstitutions; the views point into the space
+  inline void textById(
+      std::unordered_map<std::string_view, std::string_view>& textById) const;
+
+ private:
+  friend class VariantSpace;
+  const VariantSpace* _space;
+  uint64_t _index;
+  std::vector<uint32_t> _choices;
+};
+
+/// @brief Cartesian product of the alternatives of a set of flexer regions
+/// @details The variants are never materialized: they are enumerated by a
+/// mixed-radix counter (the first region is the least significant digit)
+/// and can be accessed by index, so that the space can be sharded across
+/// workers. Memory is proportional to the number of regions and
+/// alternatives.
+class VariantSpace {
+ public:
+  struct Region {
+    std::string id;
+    std::vector<std::string> alternatives;
+  };
+
+  /// @brief add a region with its alternatives, at least one
+  void addRegion(std::string id, std::vector<std::string> alternatives) {
+    messageErrorIf(alternatives.empty(),
+                   "No alternatives provided for flexer region " + id);
+    messageErrorIf(alternatives.size() > UINT32_MAX,
+                   "Too many alternatives for flexer region " + id);
+    uint64_t size;
+    messageErrorIf(__builtin_mul_overflow(_size, alternatives.size(), &size),
+                   "The variant space exceeds 2^64 variants when adding "
+                   "flexer region " +
+                       id);
+    _size = size;
+    _regions.push_back({std::move(id), std::move(alternatives)});
+  }
+
+  const std::vector<Region>& regions() const { return _regions; }
+
+  /// @brief number of variants
+  uint64_t size() const { return _size; }
+
+  /// @brief variant at the given position of the enumeration
+  Variant at(uint64_t index) const {
+    messageErrorIf(index >= _size, "Variant " + std::to_string(index) +
+                                       " out of range, the space has " +
+                                       std::to_string(_size) + " variants");
+    std::vector<uint32_t> choices(_regions.size());
+    uint64_t rest = index;
+    for (size_t i = 0; i < _regions.size(); i++) {
+      uint64_t radix = _regions[i].alternatives.size();
+      choices[i] = static_cast<uint32_t>(rest % radix);
+      rest /= radix;
+    }
+    return Variant(this, index, std::move(choices));
+  }
+
+  /// @brief range [first, second) of the indices of shard k out of n; the
+  /// shards partition the space and differ in size by at most one
+  std::pair<uint64_t, uint64_t> shard(uint64_t k, uint64_t n) const {
+    messageErrorIf(n == 0 || k >= n, "Invalid shard " + std::to_string(k) +
+                                         " of " + std::to_string(n));
+    uint64_t base = _size / n;
+    uint64_t extra = _size % n;
+    uint64_t first = k * base + std::min(k, extra);
+    return {first, first + base + (k < extra ? 1 : 0)};
+  }
+
+  /// @brief forward iterator over a range of variants; incrementing it
+  /// updates the mixed-radix counter in place
+  class Iterator {
+   public:
+    using iterator_category = std::forward_iterator_tag;
+    using value_type = Variant;
+    using difference_type = std::ptrdiff_t;
+    using pointer = const Variant*;
+    using reference = const Variant&;
+
+    Iterator(const VariantSpace* space, uint64_t index)
+        : _variant(index < space->size() ? space->at(index)
+                                         : Variant(space, index, {})) {}
+
+    const Variant& operator*() const { return _variant; }
+    const Variant* operator->() const { return &_variant; }
+
+    Iterator& operator++() {
+      const auto& regions = _variant._space->regions();
+      auto& choices = _variant._choices;
+      ++_variant._index;
+      for (size_t i = 0; i < choices.size(); i++) {
+        if (++choices[i] < regions[i].alternatives.size()) {
+          break;
+        }
+        choices[i] = 0;
+      }
+      return *this;
+    }
+
+    Iterator operator++(int) {
+      Iterator previous = *this;
+      ++*this;
+      return previous;
+    }
+
+    bool operator==(const Iterator& other) const {
+      return _variant._index == other._variant._index;
+    }
+    bool operator!=(const Iterator& other) const { return !(*this == other); }
+
+   private:
+    Variant _variant;
+  };
+
+  /// @brief iterator on the variant at the given index, size() for the end
+  Iterator iteratorAt(uint64_t index) const {
+    return Iterator(this, std::min(index, _size));
+  }
+
+  Iterator begin() const { return iteratorAt(0); }
+  Iterator end() const { return iteratorAt(_size); }
+
+ private:
+  std::vector<Region> _regions;
+  uint64_t _size = 1;
+};
+
+inline std::string_view Variant::textOf(size_t region) const {
+  return _space->regions()[region].alternatives[_choices[region]];
+}
+
+inline void Variant::textById(
+    std::unordered_map<std::string_view, std::string_view>& textById) const {
+  textById.clear();
+  const auto& regions = _space->regions();
+  for (size_t i = 0; i < regions.size(); i++) {
+    textById[regions[i].id] = textOf(i);
+  }
+}
+
+}  // namespace flexer
@@ -0,0 +1,369 @@
+#pragma once
+
+#include <dirent.h>
+#include <fcntl.h>
+#include <fnmatch.h>
+#include <strings.h>
+#include <sys/stat.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <array>
+#include <cctype>
+#include <cstring>
+#include <functional>
+#include <iterator>
+#include <memory>
+#include <string>
+#include <string_view>
+#include <vector>
+
+#include "message.hh"
+#include "profiler.hh"
+#include "threadPool.hh"
+
+namespace flexer {
+
+///options of the source tree traversal
+struct WalkOptions {
+  ///extensions of the files to collect (".cc", "cc" and "*.cc" are
+  ///equivalent), matched case-insensitively
+  std::vector<std::string> extensions;
+  ///globs of the entries to skip, matched against the entry name and
+  ///against its path relative to the root
+  std::vector<std::string> excludes;
+  ///skip the entries ignored by the .gitignore files of the tree
+  bool gitignore = false;
+  ///number of threads walking the tree
+  size_t jobs = 1;
+};
+
+///case-insensitive extension matcher built once per traversal: the
+///extensions are bucketed by length, so a file name is matched without
+///allocating
+class ExtensionMatcher {
+public:
+  explicit ExtensionMatcher(const std::vector<std::string> &extensions) {
+    for (std::string ext : extensions) {
+      if (!ext.empty() && ext[0] == '*') {
+        ext.erase(0, 1);
+      }
+      if (!ext.empty() && ext[0] == '.') {
+        ext.erase(0, 1);
+      }
+      if (ext.empty() || ext.size() >= _byLength.size()) {
+        continue;
+      }
+      std::transform(ext.begin(), ext.end(), ext.begin(), ::tolower);
+      _byLength[ext.size()].push_back(ext);
+    }
+  }
+
+  ///true if the extension of name (as in std::filesystem::path) is one of
+  ///the extensions
+  bool matches(std::string_view name) const {
+    size_t dot = name.rfind('.');
+    // no extension, or a hidden file without extension such as ".bashrc"
+    if (dot == std::string_view::npos || dot == 0) {
+      return false;
+    }
+    size_t length = name.size() - dot - 1;
+    if (length == 0 || length >= _byLength.size()) {
+      return false;
+    }
+    for (const auto &ext : _byLength[length]) {
+      if (strncasecmp(name.data() + dot + 1, ext.data(), length) == 0) {
+        return true;
+      }
+    }
+    return false;
+  }
+
+private:
+  std::array<std::vector<std::string>, 32> _byLength;
+};
+
+///rules of one .gitignore file; rules of the parent directories are
+///reached through parent
+struct IgnoreRules {
+  struct Rule {
+    std::string pattern;
+    bool negate = false;
+    bool dirOnly = false;
+    ///the pattern contains a '/' and is matched against the path
+    ///relative to the directory of the .gitignore
+    bool anchored = false;
+  };
+
+  std::shared_ptr<const IgnoreRules> parent;
+  ///directory of the .gitignore relative to the root of the walk, with a
+  ///trailing '/' unless empty
+  std::string base;
+  std::vector<Rule> rules;
+
+  ///parse the content of a .gitignore file, the supported syntax is the
+  ///one understood by fnmatch plus '!', leading and trailing '/'
+  void parse(std::string_view content) {
+    size_t pos = 0;
+    while (pos < content.size()) {
+      size_t eol = content.find('\n', pos);
+      if (eol == std::string_view::npos) {
+        eol = content.size();
+      }
+      std::string line(content.substr(pos, eol - pos));
+      pos = eol + 1;
+
+      while (!line.empty() &&
+             (line.back() == '\r' || line.back() == ' ')) {
+        line.pop_back();
+      }
+      if (line.empty() || line[0] == '#') {
+        continue;
+      }
+
+      Rule rule;
+      if (line[0] == '!') {
+        rule.negate = true;
+        line.erase(0, 1);
+      }
+      if (!line.empty() && line.back() == '/') {
+        rule.dirOnly = true;
+        line.pop_back();
+      }
+      if (!line.empty() && line[0] == '/') {
+        rule.anchored = true;
+        line.erase(0, 1);
+      }
+      if (line.find('/') != std::string::npos) {
+        rule.anchored = true;
+      }
+      if (line.empty()) {
+        continue;
+      }
+      rule.pattern = std::move(line);
+      rules.push_back(std::move(rule));
+    }
+  }
+
+  ///decision for an entry: 1 ignored, -1 re-included, 0 no rule matched;
+  ///the last matching rule of the deepest .gitignore wins
+  int match(const std::string &relPath, const char *name,
+            bool isDir) const {
+    for (auto it = rules.rbegin(); it != rules.rend(); ++it) {
+      if (it->dirOnly && !isDir) {
+        continue;
+      }
+      bool matched =
+          it->anchored
+              ? relPath.compare(0, base.size(), base) == 0 &&
+                    fnmatch(it->pattern.c_str(),
+                            relPath.c_str() + base.size(),
+                            FNM_PATHNAME) == 0
+              : fnmatch(it->pattern.c_str(), name, 0) == 0;
+      if (matched) {
+        return it->negate ? -1 : 1;
+      }
+    }
+    return parent ? parent->match(relPath, name, isDir) : 0;
+  }
+};
+
+///parallel traversal of a source tree based on getdents64: the type of
+///the entries is taken from d_type, so that no stat is needed except on
+///file systems not reporting it and on symbolic links
+class DirectoryWalker {
+public:
+  DirectoryWalker(const std::string &root, const WalkOptions &options)
+      : _root(root), _options(options), _matcher(options.extensions) {
+    while (_root.size() > 1 && _root.back() == '/') {
+      _root.pop_back();
+    }
+  }
+
+  ///collect the matching files, sorted by path
+  std::vector<std::string> run() {
+    std::vector<std::string> result;
+
+    if (_options.jobs <= 1) {
+      std::vector<Directory> stack{{"", nullptr}};
+      while (!stack.empty()) {
+        Directory dir = std::move(stack.back());
+        stack.pop_back();
+        walk(dir, result,
+             [&stack](Directory sub) { stack.push_back(std::move(sub)); });
+      }
+    } else {
+      WorkStealingPool pool(_options.jobs);
+      // one buffer per worker, merged once at the end
+      std::vector<std::vector<std::string>> perWorker(pool.size());
+      std::function<void(Directory)> spawn;
+      spawn = [&](Directory dir) {
+        pool.submit([&, dir = std::move(dir)]() mutable {
+          walk(dir, perWorker[pool.currentWorker()], spawn);
+        });
+      };
+      spawn({"", nullptr});
+      pool.wait();
+      for (auto &files : perWorker) {
+        std::move(files.begin(), files.end(), std::back_inserter(result));
+      }
+    }
+
+    std::sort(result.begin(), result.end());
+    return result;
+  }
+
+private:
+  struct Directory {
+    ///path relative to the root, empty for the root itself
+    std::string relPath;
+    std::shared_ptr<const IgnoreRules> ignoreRules;
+  };
+
+  struct linux_dirent64 {
+    ino64_t d_ino;
+    off64_t d_off;
+    unsigned short d_reclen;
+    unsigned char d_type;
+    char d_name[];
+  };
+
+  std::string fullPath(const std::string &relPath) const {
+    if (relPath.empty()) {
+      return _root;
+    }
+    return _root == "/" ? _root + relPath : _root + "/" + relPath;
+  }
+
+  bool excluded(const std::string &relPath, const char *name) const {
+    for (const auto &glob : _options.excludes) {
+      if (fnmatch(glob.c_str(), name, 0) == 0 ||
+          fnmatch(glob.c_str(), relPath.c_str(), FNM_PATHNAME) == 0) {
+        return true;
+      }
+    }
+    return false;
+  }
+
+  ///rules of the .gitignore in dirFd chained to the inherited ones
+  std::shared_ptr<const IgnoreRules>
+  loadIgnoreRules(int dirFd, const Directory &dir) const {
+    int fd = openat(dirFd, ".gitignore", O_RDONLY | O_CLOEXEC);
+    if (fd < 0) {
+      return dir.ignoreRules;
+    }
+    std::string content;
+    char buffer[4096];
+    ssize_t n;
+    while ((n = read(fd, buffer, sizeof(buffer))) > 0) {
+      content.append(buffer, static_cast<size_t>(n));
+    }
+    close(fd);
+
+    auto rules = std::make_shared<IgnoreRules>();
+    rules->parent = dir.ignoreRules;
+    rules->base = dir.relPath.empty() ? "" : dir.relPath + "/";
+    rules->parse(content);
+    if (rules->rules.empty()) {
+      return dir.ignoreRules;
+    }
+    return rules;
+  }
+
+  template <typename Spawn>
+  void walk(const Directory &dir, std::vector<std::string> &out,
+            const Spawn &spawn) const {
+    std::string path = fullPath(dir.relPath);
+    int dirFd = openat(AT_FDCWD, path.c_str(),
+                       O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+    if (dirFd < 0) {
+      messageWarning("Cannot open directory " + path + ": " +
+                     std::string(strerror(errno)));
+      return;
+    }
+
+    std::shared_ptr<const IgnoreRules> ignoreRules =
+        _options.gitignore ? loadIgnoreRules(dirFd, dir) : nullptr;
+
+    alignas(linux_dirent64) char buffer[32 * 1024];
+    while (true) {
+      long nRead = syscall(SYS_getdents64, dirFd, buffer, sizeof(buffer));
+      if (nRead <= 0) {
+        messageWarningIf(nRead < 0, "Cannot read directory " + path + ": " +
+                                        std::string(strerror(errno)));
+        break;
+      }
+
+      for (long offset = 0; offset < nRead;) {
+        auto *entry = reinterpret_cast<linux_dirent64 *>(buffer + offset);
+        offset += entry->d_reclen;
+
+        const char *name = entry->d_name;
+        if (name[0] == '.' &&
+            (name[1] == '\0' || (name[1] == '.' && name[2] == '\0'))) {
+          continue;
+        }
+
+        unsigned char type = entry->d_type;
+        if (type == DT_UNKNOWN || type == DT_LNK) {
+          // follow symbolic links to files but not to directories, as
+          // std::filesystem::recursive_directory_iterator does
+          struct stat st;
+          if (fstatat(dirFd, name, &st, AT_SYMLINK_NOFOLLOW) != 0) {
+            continue;
+          }
+          // d_type is not filled by every filesystem: the link itself
+          // tells whether the entry is a link
+          bool isLink = S_ISLNK(st.st_mode);
+          if (isLink && fstatat(dirFd, name, &st, 0) != 0) {
+            continue;
+          }
+          type = S_ISREG(st.st_mode)
+                     ? DT_REG
+                     : (S_ISDIR(st.st_mode) && !isLink ? DT_DIR : DT_UNKNOWN);
+        }
+        if (type != DT_REG && type != DT_DIR) {
+          continue;
+        }
+        // files are filtered by extension before building any path
+        if (type == DT_REG && !_matcher.matches(name)) {
+          continue;
+        }
+
+        std::string relPath =
+            dir.relPath.empty() ? name : dir.relPath + "/" + name;
+        if (excluded(relPath, name)) {
+          continue;
+        }
+        if (ignoreRules &&
+            ignoreRules->match(relPath, name, type == DT_DIR) == 1) {
+          continue;
+        }
+
+        if (type == DT_DIR) {
+          spawn(Directory{std::move(relPath), ignoreRules});
+        } else {
+          out.push_back(fullPath(relPath));
+        }
+      }
+    }
+
+    close(dirFd);
+  }
+
+  std::string _root;
+  const WalkOptions &_options;
+  ExtensionMatcher _matcher;
+};
+
+///find all the files under directoryPath with one of the given
+///extensions, pruning the excluded directories
+inline std::vector<std::string>
+findFilesWithExtensions(const std::string &directoryPath,
+                        const WalkOptions &options) {
+  FLEXER_PROFILE_SCOPE("search sources");
+  return DirectoryWalker(directoryPath, options).run();
+}
+
+} // namespace flexer
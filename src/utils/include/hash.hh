@@ -0,0 +1,62 @@
+#pragma once
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <string_view>
+
+namespace flexer {
+
+///finalizer of splitmix64: spreads every input bit over the whole word
+inline uint64_t mix64(uint64_t x) {
+  x ^= x >> 30;
+  x *= 0xbf58476d1ce4e5b9ULL;
+  x ^= x >> 27;
+  x *= 0x94d049bb133111ebULL;
+  x ^= x >> 31;
+  return x;
+}
+
+///fast non-cryptographic 64 bit hash of a buffer, used to detect changes
+///in file contents; four independent lanes keep the multipliers busy
+inline uint64_t fastHash64(const char *data, size_t size,
+                           uint64_t seed = 0) {
+  const uint64_t k = 0x9e3779b97f4a7c15ULL;
+  uint64_t lanes[4] = {seed ^ k, seed + k, seed ^ (k << 1),
+                       seed - k};
+  const char *p = data;
+  const char *end = data + size;
+
+  for (; p + 32 <= end; p += 32) {
+    for (size_t i = 0; i < 4; i++) {
+      uint64_t word;
+      std::memcpy(&word, p + i * 8, 8);
+      lanes[i] = (lanes[i] ^ word) * k;
+      lanes[i] ^= lanes[i] >> 29;
+    }
+  }
+
+  uint64_t h = mix64(size ^ seed);
+  for (size_t i = 0; i < 4; i++) {
+    h = mix64(h ^ lanes[i]);
+  }
+
+  for (; p + 8 <= end; p += 8) {
+    uint64_t word;
+    std::memcpy(&word, p, 8);
+    h = mix64(h ^ word);
+  }
+
+  if (p < end) {
+    uint64_t word = 0;
+    std::memcpy(&word, p, static_cast<size_t>(end - p));
+    h = mix64(h ^ word ^ (uint64_t(end - p) << 56));
+  }
+
+  return h;
+}
+
+inline uint64_t fastHash64(std::string_view str, uint64_t seed = 0) {
+  return fastHash64(str.data(), str.size(), seed);
+}
+
+} // namespace flexer
@@ -1,14 +1,18 @@
 #pragma once
 #include "message.hh"
 #include <algorithm>
-#include <chrono>
+#include <array>
+#include <cctype>
+#include <cstdint>
 #include <cstring>
 #include <fstream>
 #include <iostream>
 #include <ostream>
 #include <sstream>
 #include <string>
+#include <string_view>
 #include <unordered_map>
+#include <utility>
 #include <vector>
 
 long long inline safeStoll(const std::string &str, int base = 10) {
@@ -136,89 +140,151 @@ inline std::string removeSpaces(const std::string &input) {
   return str;
 }
 
-///replace all occurences of a string with a set of strings (tokens), the longest match always have higher priority
-inline void
-replace(const std::vector<std::pair<std::string, std::string>>
-            &tokenAndSubstitution,
-        std::string &inputString) {
-  //token, substitution, current matcthing index, has matched
-  std::vector<std::tuple<std::string, std::string, size_t, bool>>
-      tokens;
-  std::string outputString = "";
-  //size of active tokens
-  size_t size = tokenAndSubstitution.size();
-  //current starting point of matching
-  size_t start = 0;
-
-  std::pair<std::string, std::string> lastMatch =
-      std::make_pair("", "");
-
-  //load tokens
-  for (auto &tokenPair : tokenAndSubstitution) {
-    tokens.emplace_back(tokenPair.first, tokenPair.second, 0, 0);
-  }
-
-  for (size_t i = 0; i <= inputString.size(); i++) {
-    lastMatch = std::make_pair("", "");
-    //for each token in the 'virtual' vector [active1, active2 ... activek | inactivek+1 ... inactiveN]
-    for (size_t j = 0; j < size; j++) {
-      auto &token = tokens[j];
-      if (i < inputString.size() /*end of inputstring*/ &&
-          std::get<2>(token) <
-              std::get<0>(token).size() && /*end of token*/
-          std::get<0>(token)[std::get<2>(token)] ==
-              inputString[i] /*char matches*/) {
-        //increase internal index of token
-        std::get<2>(token)++;
-        //if token is fully matched
-        if (std::get<2>(token) == std::get<0>(token).size()) {
-          std::get<3>(token) = 1;
+///multi-pattern replacer compiled once from a set of tokens and reusable
+///on any number of inputs: the tokens are matched by an Aho-Corasick
+///automaton, the leftmost occurrence is replaced first and, among the
+///tokens starting at the same position, the longest one wins
+class MultiPatternReplacer {
+public:
+  explicit MultiPatternReplacer(
+      const std::vector<std::pair<std::string, std::string>>
+          &tokenAndSubstitution) {
+    newState(0);
+
+    //build the trie, empty tokens never match
+    for (auto &[token, substitution] : tokenAndSubstitution) {
+      if (token.empty()) {
+        continue;
+      }
+      int32_t state = 0;
+      for (unsigned char c : token) {
+        if (_next[state][c] == 0) {
+          _next[state][c] = newState(_depth[state] + 1);
         }
-      } else {
-        //the token does not match
+        state = _next[state][c];
+      }
+      //with repeated tokens the first substitution is kept
+      if (_match[state] == -1) {
+        _match[state] = static_cast<int32_t>(_substitutions.size());
+        _substitutions.push_back(substitution);
+        _tokenLength.push_back(token.size());
+      }
+    }
 
-        //if the token was fully matched
-        if (std::get<3>(token)) {
-          //save the last fully matched token
-          lastMatch =
-              std::make_pair(std::get<0>(token), std::get<1>(token));
+    //turn the trie into a DFA following the failure links breadth first
+    std::vector<int32_t> fail(_next.size(), 0);
+    std::vector<int32_t> queue;
+    queue.reserve(_next.size());
+    for (size_t c = 0; c < 256; c++) {
+      if (_next[0][c] != 0) {
+        queue.push_back(_next[0][c]);
+      }
+    }
+    for (size_t head = 0; head < queue.size(); head++) {
+      int32_t state = queue[head];
+      //the longest token ending in a state is either the state itself or
+      //the longest token ending in its failure state
+      if (_match[state] == -1) {
+        _match[state] = _match[fail[state]];
+      }
+      for (size_t c = 0; c < 256; c++) {
+        int32_t child = _next[state][c];
+        if (child != 0) {
+          fail[child] = _next[fail[state]][c];
+          queue.push_back(child);
+        } else {
+          _next[state][c] = _next[fail[state]][c];
         }
-        //move unmatched token to the end of the vector
-        std::swap(tokens[j], tokens[size - 1]);
-        //decrease size of the 'virtual' vector
-        size--;
-        //decrease index to check the swapped token
-        j--;
       }
     }
+  }
 
-    //if all tokens did not match on this char
-    if (size == 0) {
-      if (lastMatch.first != "") {
-        //one token fully matched
-        //replace the token
-        outputString += lastMatch.second;
-        //move index back as the last matched token is observed after the last matched char
-        i--;
-      } else {
-        //no tokens fully matched
-        outputString += inputString.substr(start, i - start + 1);
+  ///write inputString with the tokens replaced to outputString
+  void replace(const std::string &inputString,
+               std::string &outputString) const {
+    outputString.clear();
+    outputString.reserve(inputString.size());
+
+    const size_t npos = std::string::npos;
+    const size_t size = inputString.size();
+    //inputString[0, copied) has already been written
+    size_t copied = 0;
+    size_t pos = 0;
+    int32_t state = 0;
+    //best match found so far: leftmost, then longest
+    size_t matchStart = npos;
+    int32_t matchToken = -1;
+
+    while (true) {
+      if (pos < size) {
+        state = _next[state][static_cast<unsigned char>(inputString[pos])];
+        pos++;
+        int32_t token = _match[state];
+        if (token != -1) {
+          size_t start = pos - _tokenLength[token];
+          if (matchStart == npos || start < matchStart ||
+              (start == matchStart &&
+               _tokenLength[token] > _tokenLength[matchToken])) {
+            matchStart = start;
+            matchToken = token;
+          }
+        }
+        //a match is final once no partial match starts at or before it
+        if (matchStart == npos ||
+            pos - _depth[state] <= matchStart) {
+          continue;
+        }
+      } else if (matchStart == npos) {
+        break;
       }
 
-      //new start is set after the token that was replaced
-      start = i + 1;
-
-      //reset the list of tokens : all tokens become active
-      for (auto &token : tokens) {
-        std::get<2>(token) = 0;
-        std::get<3>(token) = 0;
-      }
-      size = tokenAndSubstitution.size();
+      outputString.append(inputString, copied, matchStart - copied);
+      outputString += _substitutions[matchToken];
+      copied = matchStart + _tokenLength[matchToken];
+      //restart right after the replaced token
+      pos = copied;
+      state = 0;
+      matchStart = npos;
+      matchToken = -1;
     }
+
+    outputString.append(inputString, copied, npos);
+  }
+
+  std::string replace(const std::string &inputString) const {
+    std::string outputString;
+    replace(inputString, outputString);
+    return outputString;
+  }
+
+private:
+  int32_t newState(int32_t depth) {
+    _next.emplace_back();
+    _next.back().fill(0);
+    _depth.push_back(depth);
+    _match.push_back(-1);
+    return static_cast<int32_t>(_next.size() - 1);
   }
 
-  //return
-  inputString = outputString;
+  ///transitions of the automaton
+  std::vector<std::array<int32_t, 256>> _next;
+  ///length of the prefix of a token represented by each state
+  std::vector<int32_t> _depth;
+  ///longest token ending in each state, -1 if none
+  std::vector<int32_t> _match;
+  std::vector<std::string> _substitutions;
+  std::vector<size_t> _tokenLength;
+};
+
+///replace all occurences of a string with a set of strings (tokens), the longest match always have higher priority
+inline void
+replace(const std::vector<std::pair<std::string, std::string>>
+            &tokenAndSubstitution,
+        std::string &inputString) {
+  std::string outputString;
+  MultiPatternReplacer(tokenAndSubstitution)
+      .replace(inputString, outputString);
+  inputString.swap(outputString);
 }
 
 ///replace all occurences of a string with a set of strings (tokens)
@@ -242,6 +308,151 @@ inline void replace(const std::unordered_map<std::string, std::string>
   replace(tokenAndSubstitutionVec, inputString);
 }
 
+///text with ${NAME} placeholders compiled once into a list of literal and
+///placeholder segments; instantiating it for an assignment of the
+///parameters is a single pass into a buffer reserved upfront, the text is
+///never parsed again. NAME is made of letters, digits and '_', "$${" is a
+///literal "${"
+class CompiledTemplate {
+public:
+  explicit CompiledTemplate(std::string text) : _text(std::move(text)) {
+    size_t literalBegin = 0;
+    size_t i = 0;
+    while (i < _text.size()) {
+      if (_text[i] != '$') {
+        i++;
+        continue;
+      }
+      //escaped placeholder: drop the first '$'
+      if (_text.compare(i, 3, "$${") == 0) {
+        addLiteral(literalBegin, i - literalBegin);
+        literalBegin = i + 1;
+        i += 3;
+        continue;
+      }
+      if (_text.compare(i, 2, "${") != 0) {
+        i++;
+        continue;
+      }
+      size_t nameBegin = i + 2;
+      size_t nameEnd = nameBegin;
+      while (nameEnd < _text.size() &&
+             (std::isalnum(static_cast<unsigned char>(_text[nameEnd])) ||
+              _text[nameEnd] == '_')) {
+        nameEnd++;
+      }
+      if (nameEnd == nameBegin || nameEnd == _text.size() ||
+          _text[nameEnd] != '}') {
+        //not a placeholder, keep it as text
+        i++;
+        continue;
+      }
+
+      addLiteral(literalBegin, i - literalBegin);
+      std::string name = _text.substr(nameBegin, nameEnd - nameBegin);
+      auto slot = _slots.find(name);
+      if (slot == _slots.end()) {
+        slot = _slots.emplace(name, _parameters.size()).first;
+        _parameters.push_back(name);
+        _uses.push_back(0);
+      }
+      _uses[slot->second]++;
+      _segments.push_back({0, 0, slot->second});
+      i = nameEnd + 1;
+      literalBegin = i;
+    }
+    addLiteral(literalBegin, _text.size() - literalBegin);
+  }
+
+  ///names of the parameters in order of first appearance, the position of
+  ///a name is its slot
+  const std::vector<std::string> &parameters() const {
+    return _parameters;
+  }
+
+  ///slot of the parameter, std::string::npos if it is not used
+  size_t slotOf(const std::string &name) const {
+    auto slot = _slots.find(name);
+    return slot == _slots.end() ? std::string::npos : slot->second;
+  }
+
+  ///write the text with each placeholder replaced by values[slot] to
+  ///outputString; Values is any indexable container of strings or
+  ///string_views with one value per parameter
+  template <typename Values>
+  void instantiate(const Values &values,
+                   std::string &outputString) const {
+    messageErrorIf(values.size() < _parameters.size(),
+                   "Missing template parameters: expected " +
+                       std::to_string(_parameters.size()) + ", got " +
+                       std::to_string(values.size()));
+    size_t size = _literalSize;
+    for (size_t i = 0; i < _parameters.size(); i++) {
+      size += std::string_view(values[i]).size() * _uses[i];
+    }
+
+    outputString.clear();
+    outputString.reserve(size);
+    for (const auto &segment : _segments) {
+      if (segment.slot == literal) {
+        outputString.append(_text, segment.begin, segment.length);
+      } else {
+        outputString += std::string_view(values[segment.slot]);
+      }
+    }
+  }
+
+  template <typename Values>
+  std::string instantiate(const Values &values) const {
+    std::string outputString;
+    instantiate(values, outputString);
+    return outputString;
+  }
+
+  ///instantiate with the values given by parameter name
+  void instantiate(
+      const std::unordered_map<std::string, std::string> &values,
+      std::string &outputString) const {
+    std::vector<std::string_view> bySlot;
+    bySlot.reserve(_parameters.size());
+    for (const auto &name : _parameters) {
+      auto value = values.find(name);
+      messageErrorIf(value == values.end(),
+                     "Missing value for template parameter '" + name +
+                         "'");
+      bySlot.push_back(value->second);
+    }
+    instantiate(bySlot, outputString);
+  }
+
+private:
+  static constexpr size_t literal = std::string::npos;
+
+  struct Segment {
+    ///range of a literal segment in _text
+    size_t begin;
+    size_t length;
+    ///parameter of a placeholder, literal otherwise
+    size_t slot;
+  };
+
+  void addLiteral(size_t begin, size_t length) {
+    if (length == 0) {
+      return;
+    }
+    _segments.push_back({begin, length, literal});
+    _literalSize += length;
+  }
+
+  std::string _text;
+  std::vector<Segment> _segments;
+  std::vector<std::string> _parameters;
+  std::unordered_map<std::string, size_t> _slots;
+  ///number of placeholders of each parameter
+  std::vector<size_t> _uses;
+  size_t _literalSize = 0;
+};
+
 // Function to escape reserved characters in a regex pattern
 inline std::string escapeRegex(const std::string &pattern) {
   // Characters that need to be escaped in a regex pattern
@@ -290,72 +501,6 @@ inline bool isFloat(const std::string &s) {
   strtof(s.c_str(), &p);
   return *p == 0;
 }
-///dirty implementation of timer, can be used to measure time between two calls of the same timer
-///id is the name of the timer
-///start_stop is 1 if the timer should be started, 0 if the timer should be stopped
-///if start_stop is 0, the function returns the time in seconds since the timer was started
-inline size_t dirtyTimerSeconds(std::string id, bool start_stop) {
-  static std::unordered_map<std::string,
-                            std::chrono::steady_clock::time_point>
-      idToStart;
-  if (start_stop) {
-    idToStart[id] = std::chrono::steady_clock::now();
-    return -1;
-  } else {
-    messageErrorIf(!idToStart.count(id),
-                   "Use of undefined timer '" + id + "'");
-    return std::chrono::duration_cast<std::chrono::seconds>(
-               std::chrono::steady_clock::now() - idToStart.at(id))
-        .count();
-  }
-}
-///check if the timer is timed out
-inline bool isTimeOutSeconds(std::string id, size_t time) {
-  return dirtyTimerSeconds(id, 0) >= time;
-}
-
-inline size_t dirtyTimerMilliseconds(std::string id,
-                                     bool start_stop) {
-  static std::unordered_map<std::string,
-                            std::chrono::steady_clock::time_point>
-      idToStart;
-  if (start_stop) {
-    idToStart[id] = std::chrono::steady_clock::now();
-    return -1;
-  } else {
-    messageErrorIf(!idToStart.count(id),
-                   "Use of undefined timer '" + id + "'");
-    return std::chrono::duration_cast<std::chrono::milliseconds>(
-               std::chrono::steady_clock::now() - idToStart.at(id))
-        .count();
-  }
-}
-
-inline bool isTimeOutMilliseconds(std::string id, size_t time) {
-  return dirtyTimerMilliseconds(id, 0) >= time;
-}
-
-inline size_t dirtyTimerMicroseconds(std::string id,
-                                     bool start_stop) {
-  static std::unordered_map<std::string,
-                            std::chrono::steady_clock::time_point>
-      idToStart;
-  if (start_stop) {
-    idToStart[id] = std::chrono::steady_clock::now();
-    return -1;
-  } else {
-    messageErrorIf(!idToStart.count(id),
-                   "Use of undefined timer '" + id + "'");
-    return std::chrono::duration_cast<std::chrono::microseconds>(
-               std::chrono::steady_clock::now() - idToStart.at(id))
-        .count();
-  }
-}
-
-inline bool isTimeOutMicroseconds(std::string id, size_t time) {
-  return dirtyTimerMicroseconds(id, 0) >= time;
-}
-
 ///extract bits from an integer
 template <typename T>
 inline T extractBits(T num, size_t lower_bound, size_t upper_bound) {
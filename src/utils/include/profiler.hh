@@ -0,0 +1,135 @@
+#pragma once
+
+#include <array>
+#include <atomic>
+#include <cstdint>
+#include <memory>
+#include <mutex>
+#include <ostream>
+#include <string>
+#include <vector>
+
+#include "trace.hh"
+
+namespace flexer {
+
+///identifier of an interned scope name
+using ProfileScopeId = uint32_t;
+
+///durations of the executions of a scope, in nanoseconds
+struct ProfileStats {
+  ///the histogram has 4 buckets per power of two: percentiles are
+  ///accurate within 12.5%
+  static constexpr size_t nBuckets = 256;
+
+  uint64_t count = 0;
+  uint64_t total = 0;
+  uint64_t min = UINT64_MAX;
+  uint64_t max = 0;
+  std::array<uint64_t, nBuckets> histogram{};
+
+  void add(uint64_t ns) {
+    count++;
+    total += ns;
+    min = ns < min ? ns : min;
+    max = ns > max ? ns : max;
+    histogram[bucketOf(ns)]++;
+  }
+
+  void merge(const ProfileStats &other);
+
+  ///approximate duration below which a fraction p of the executions
+  ///fall
+  uint64_t percentile(double p) const;
+
+  static size_t bucketOf(uint64_t ns) {
+    if (ns < 4) {
+      return ns;
+    }
+    size_t e = 63 - __builtin_clzll(ns);
+    return 4 * (e - 1) + ((ns >> (e - 2)) & 3);
+  }
+};
+
+///hierarchical profiler of the scopes marked with FLEXER_PROFILE_SCOPE
+///
+///Every thread records into its own call tree: entering a scope moves
+///to a child of the current node, leaving it adds the duration to the
+///statistics of the node. The trees of all the threads are merged by
+///path when reporting. When the profiler is disabled a scope costs one
+///relaxed load.
+class Profiler {
+public:
+  ///id of the scope name, the same for equal names
+  static ProfileScopeId intern(const char *name);
+
+  static const std::string &nameOf(ProfileScopeId scope);
+
+  static void enable() { _enabled.store(true, std::memory_order_relaxed); }
+  static bool enabled() {
+    return _enabled.load(std::memory_order_relaxed);
+  }
+
+  ///print the merged call tree with the statistics of each scope; call
+  ///it when the profiled threads are idle for a consistent snapshot
+  static void report(std::ostream &os);
+
+  ///write the merged call tree as JSON to path
+  static void exportJson(const std::string &path);
+
+  static void enter(ProfileScopeId scope);
+  static void leave(uint64_t ns);
+
+private:
+  static inline std::atomic<bool> _enabled{false};
+};
+
+///times the enclosing scope, and records it as a trace event when
+///tracing
+class ProfileScope {
+public:
+  explicit ProfileScope(ProfileScopeId scope)
+      : _scope(scope), _profile(Profiler::enabled()),
+        _trace(Tracer::enabled()) {
+    if (_profile) {
+      Profiler::enter(scope);
+    }
+    if (_profile || _trace) {
+      _start = Tracer::now();
+    }
+  }
+
+  ~ProfileScope() {
+    if (_profile || _trace) {
+      uint64_t end = Tracer::now();
+      if (_profile) {
+        Profiler::leave(end - _start);
+      }
+      if (_trace) {
+        Tracer::record(_scope, _start, end);
+      }
+    }
+  }
+
+  ProfileScope(const ProfileScope &) = delete;
+  ProfileScope &operator=(const ProfileScope &) = delete;
+
+private:
+  ProfileScopeId _scope;
+  bool _profile;
+  bool _trace;
+  uint64_t _start = 0;
+};
+
+#define FLEXER_PROFILE_CONCAT_(a, b) a##b
+#define FLEXER_PROFILE_CONCAT(a, b) FLEXER_PROFILE_CONCAT_(a, b)
+
+///time the enclosing scope under name, a string literal; the name is
+///interned once per call site
+#define FLEXER_PROFILE_SCOPE(name)                                    \
+  static const flexer::ProfileScopeId FLEXER_PROFILE_CONCAT(          \
+      _profileScopeId, __LINE__) = flexer::Profiler::intern(name);    \
+  flexer::ProfileScope FLEXER_PROFILE_CONCAT(_profileScope, __LINE__)( \
+      FLEXER_PROFILE_CONCAT(_profileScopeId, __LINE__))
+
+} // namespace flexer
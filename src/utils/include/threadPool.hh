@@ -0,0 +1,186 @@
+#pragma once
+
+#include <atomic>
+#include <condition_variable>
+#include <cstddef>
+#include <deque>
+#include <exception>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "crashHandler.hh"
+#include "trace.hh"
+
+namespace flexer {
+
+///pool of threads where each worker owns a queue of tasks: a worker pops
+///from the back of its own queue and, once empty, steals from the front
+///of the others
+class WorkStealingPool {
+public:
+  using Task = std::function<void()>;
+
+  explicit WorkStealingPool(size_t nThreads) {
+    nThreads = nThreads == 0 ? 1 : nThreads;
+    for (size_t i = 0; i < nThreads; i++) {
+      _queues.emplace_back(std::make_unique<WorkerQueue>());
+    }
+    for (size_t i = 0; i < nThreads; i++) {
+      _workers.emplace_back([this, i] { workerLoop(i); });
+    }
+  }
+
+  WorkStealingPool(const WorkStealingPool &) = delete;
+  WorkStealingPool &operator=(const WorkStealingPool &) = delete;
+
+  ~WorkStealingPool() {
+    {
+      std::lock_guard<std::mutex> lock{_idleGuard};
+      _stop = true;
+    }
+    _idleCv.notify_all();
+    for (auto &worker : _workers) {
+      worker.join();
+    }
+  }
+
+  ///number of worker threads
+  size_t size() const { return _workers.size(); }
+
+  ///index of the calling worker of this pool, size() if the caller is
+  ///not one of its workers
+  size_t currentWorker() const {
+    return _currentPool == this ? _currentWorker : size();
+  }
+
+  ///enqueue a task: tasks submitted by a worker go to its own queue,
+  ///the others are distributed round robin
+  void submit(Task task) {
+    size_t target = currentWorker();
+    if (target == size()) {
+      target = _nextQueue.fetch_add(1, std::memory_order_relaxed) % size();
+    }
+
+    _pending.fetch_add(1, std::memory_order_relaxed);
+    // counted before it is visible: a worker popping the task right away
+    // must not decrement _queued below zero
+    {
+      std::lock_guard<std::mutex> lock{_idleGuard};
+      _queued++;
+    }
+    {
+      std::lock_guard<std::mutex> lock{_queues[target]->guard};
+      _queues[target]->tasks.push_back(std::move(task));
+    }
+    _idleCv.notify_one();
+  }
+
+  ///block until all the submitted tasks (and the tasks they submitted)
+  ///are done; rethrows the first exception raised by a task
+  void wait() {
+    std::unique_lock<std::mutex> lock{_doneGuard};
+    _doneCv.wait(lock, [this] {
+      return _pending.load(std::memory_order_acquire) == 0;
+    });
+    if (_firstException) {
+      std::exception_ptr e = _firstException;
+      _firstException = nullptr;
+      std::rethrow_exception(e);
+    }
+  }
+
+private:
+  struct WorkerQueue {
+    std::mutex guard;
+    std::deque<Task> tasks;
+  };
+
+  bool popOwn(size_t id, Task &task) {
+    auto &queue = *_queues[id];
+    std::lock_guard<std::mutex> lock{queue.guard};
+    if (queue.tasks.empty()) {
+      return false;
+    }
+    task = std::move(queue.tasks.back());
+    queue.tasks.pop_back();
+    return true;
+  }
+
+  bool steal(size_t id, Task &task) {
+    for (size_t i = 1; i < _queues.size(); i++) {
+      auto &victim = *_queues[(id + i) % _queues.size()];
+      std::lock_guard<std::mutex> lock{victim.guard};
+      if (!victim.tasks.empty()) {
+        task = std::move(victim.tasks.front());
+        victim.tasks.pop_front();
+        return true;
+      }
+    }
+    return false;
+  }
+
+  void workerLoop(size_t id) {
+    _currentPool = this;
+    _currentWorker = id;
+    // report stack overflows of the tasks too
+    hlog::installAltStack();
+    Tracer::setThreadName("worker " + std::to_string(id));
+
+    while (true) {
+      Task task;
+      if (popOwn(id, task) || steal(id, task)) {
+        {
+          std::lock_guard<std::mutex> lock{_idleGuard};
+          _queued--;
+        }
+        try {
+          task();
+        } catch (...) {
+          std::lock_guard<std::mutex> lock{_doneGuard};
+          if (!_firstException) {
+            _firstException = std::current_exception();
+          }
+        }
+        if (_pending.fetch_sub(1, std::memory_order_acq_rel) == 1) {
+          std::lock_guard<std::mutex> lock{_doneGuard};
+          _doneCv.notify_all();
+        }
+        continue;
+      }
+
+      std::unique_lock<std::mutex> lock{_idleGuard};
+      _idleCv.wait(lock, [this] { return _stop || _queued > 0; });
+      if (_stop && _queued == 0) {
+        return;
+      }
+    }
+  }
+
+  ///one queue per worker
+  std::vector<std::unique_ptr<WorkerQueue>> _queues;
+  std::vector<std::thread> _workers;
+  ///queue receiving the next task submitted from outside the pool
+  std::atomic<size_t> _nextQueue{0};
+  ///tasks submitted and not yet completed
+  std::atomic<size_t> _pending{0};
+
+  ///tasks sitting in the queues, protected by _idleGuard
+  size_t _queued = 0;
+  bool _stop = false;
+  std::mutex _idleGuard;
+  std::condition_variable _idleCv;
+
+  std::mutex _doneGuard;
+  std::condition_variable _doneCv;
+  std::exception_ptr _firstException;
+
+  inline static thread_local const WorkStealingPool *_currentPool =
+      nullptr;
+  inline static thread_local size_t _currentWorker = 0;
+};
+
+} // namespace flexer
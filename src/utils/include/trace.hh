@@ -0,0 +1,84 @@
+#pragma once
+
+#include <sys/types.h>
+
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <string>
+
+namespace flexer {
+
+///recorder of Chrome trace events (chrome://tracing, ui.perfetto.dev)
+///
+///Every thread appends complete events to its own buffer, and is shown
+///as its own track. Child processes are shown as separate processes
+///with a single track. Events are kept in memory and written by
+///write(); when the recorder is disabled nothing is recorded.
+class Tracer {
+public:
+  static void enable();
+  static bool enabled() {
+    return _enabled.load(std::memory_order_relaxed);
+  }
+
+  ///timestamp for the events, in nanoseconds
+  static uint64_t now() {
+    return std::chrono::duration_cast<std::chrono::nanoseconds>(
+               std::chrono::steady_clock::now().time_since_epoch())
+        .count();
+  }
+
+  ///name of the track of the calling thread
+  static void setThreadName(const std::string &name);
+
+  ///event of the calling thread
+  ///@param scope the name, interned by Profiler::intern
+  static void record(uint32_t scope, uint64_t startNs, uint64_t endNs);
+
+  ///event of the calling thread with a name known at runtime and an
+  ///optional detail shown in its arguments
+  static void record(const std::string &name, uint64_t startNs,
+                     uint64_t endNs, const std::string &detail = "");
+
+  ///lifetime of a child process, shown as its own track
+  static void recordProcess(const std::string &name, pid_t pid,
+                            uint64_t startNs, uint64_t endNs,
+                            const std::string &detail = "");
+
+  ///write the recorded events to path as JSON
+  static void write(const std::string &path);
+
+private:
+  static inline std::atomic<bool> _enabled{false};
+};
+
+///records the enclosing scope as an event with a runtime name
+class TraceScope {
+public:
+  TraceScope(std::string name, std::string detail = "")
+      : _active(Tracer::enabled()) {
+    if (_active) {
+      _name = std::move(name);
+      _detail = std::move(detail);
+      _start = Tracer::now();
+    }
+  }
+
+  ~TraceScope() {
+    if (_active) {
+      Tracer::record(_name, _start, Tracer::now(), _detail);
+    }
+  }
+
+  TraceScope(const TraceScope &) = delete;
+  TraceScope &operator=(const TraceScope &) = delete;
+
+private:
+  bool _active;
+  std::string _name;
+  std::string _detail;
+  uint64_t _start = 0;
+};
+
+} // namespace flexer
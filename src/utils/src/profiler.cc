@@ -0,0 +1,307 @@
+#include "profiler.hh"
+
+#include <algorithm>
+#include <deque>
+#include <fstream>
+#include <iomanip>
+#include <map>
+#include <unordered_map>
+
+#include "message.hh"
+
+namespace flexer {
+
+namespace {
+
+///lower bound of the durations of a histogram bucket
+uint64_t bucketLowerBound(size_t bucket) {
+  if (bucket < 4) {
+    return bucket;
+  }
+  size_t e = bucket / 4 + 1;
+  if (e >= 64) {
+    return UINT64_MAX;
+  }
+  return static_cast<uint64_t>(4 + bucket % 4) << (e - 2);
+}
+
+struct Names {
+  std::mutex guard;
+  std::deque<std::string> names;
+  std::unordered_map<std::string, ProfileScopeId> ids;
+};
+
+Names &names() {
+  static Names *instance = new Names();
+  return *instance;
+}
+
+constexpr ProfileScopeId rootScope = UINT32_MAX;
+
+///call tree of a thread: written by its thread, read by the reports
+struct ThreadTree {
+  struct Node {
+    ProfileScopeId scope;
+    uint32_t parent;
+    std::vector<std::pair<ProfileScopeId, uint32_t>> children;
+    ProfileStats stats;
+  };
+
+  ThreadTree() { nodes.push_back({rootScope, 0, {}, {}}); }
+
+  ///guards the statistics and the growth of nodes
+  std::mutex guard;
+  std::deque<Node> nodes;
+  uint32_t current = 0;
+};
+
+struct Trees {
+  std::mutex guard;
+  ///kept after their thread exits, to be reported
+  std::vector<std::shared_ptr<ThreadTree>> trees;
+};
+
+Trees &trees() {
+  static Trees *instance = new Trees();
+  return *instance;
+}
+
+ThreadTree &threadTree() {
+  thread_local std::shared_ptr<ThreadTree> tree;
+  if (!tree) {
+    tree = std::make_shared<ThreadTree>();
+    Trees &t = trees();
+    std::lock_guard<std::mutex> lock{t.guard};
+    t.trees.push_back(tree);
+  }
+  return *tree;
+}
+
+///call tree of all the threads merged by path
+struct MergedNode {
+  ProfileScopeId scope = rootScope;
+  ProfileStats stats;
+  std::map<ProfileScopeId, MergedNode> children;
+
+  void merge(const ThreadTree &tree, uint32_t node) {
+    stats.merge(tree.nodes[node].stats);
+    for (const auto &[scope, child] : tree.nodes[node].children) {
+      MergedNode &merged = children[scope];
+      merged.scope = scope;
+      merged.merge(tree, child);
+    }
+  }
+
+  ///children by decreasing total time
+  std::vector<const MergedNode *> sortedChildren() const {
+    std::vector<const MergedNode *> sorted;
+    for (const auto &[scope, child] : children) {
+      sorted.push_back(&child);
+    }
+    std::sort(sorted.begin(), sorted.end(),
+              [](const MergedNode *a, const MergedNode *b) {
+                return a->stats.total > b->stats.total;
+              });
+    return sorted;
+  }
+};
+
+MergedNode mergeTrees() {
+  MergedNode root;
+  Trees &t = trees();
+  std::lock_guard<std::mutex> lock{t.guard};
+  for (const auto &tree : t.trees) {
+    std::lock_guard<std::mutex> treeLock{tree->guard};
+    root.merge(*tree, 0);
+  }
+  // the root has no statistics of its own: it spans its children
+  root.stats = ProfileStats();
+  for (const auto &[scope, child] : root.children) {
+    root.stats.total += child.stats.total;
+  }
+  return root;
+}
+
+double toMs(uint64_t ns) { return static_cast<double>(ns) / 1e6; }
+
+void reportNode(std::ostream &os, const MergedNode &node,
+                uint64_t parentTotal, size_t depth) {
+  const ProfileStats &s = node.stats;
+  std::string name = std::string(2 * depth, ' ') + Profiler::nameOf(node.scope);
+  double share = parentTotal == 0
+                     ? 100.0
+                     : 100.0 * static_cast<double>(s.total) /
+                           static_cast<double>(parentTotal);
+  os << std::left << std::setw(40) << name << std::right
+     << std::setw(10) << s.count;
+  if (s.count == 0) {
+    // still open when the report is written, e.g. on an error exit: only
+    // its children have timings
+    os << std::setw(12) << "open" << "\n";
+  } else {
+    os << std::setw(12) << toMs(s.total) << std::setw(8) << share
+       << std::setw(11) << toMs(s.total / s.count) << std::setw(11)
+       << toMs(s.min) << std::setw(11) << toMs(s.percentile(0.5))
+       << std::setw(11) << toMs(s.percentile(0.9)) << std::setw(11)
+       << toMs(s.percentile(0.99)) << std::setw(11) << toMs(s.max)
+       << "\n";
+  }
+  for (const MergedNode *child : node.sortedChildren()) {
+    reportNode(os, *child, s.total, depth + 1);
+  }
+}
+
+void writeJsonString(std::ostream &os, const std::string &s) {
+  os << '"';
+  for (char c : s) {
+    if (c == '"' || c == '\\') {
+      os << '\\';
+    }
+    os << c;
+  }
+  os << '"';
+}
+
+void exportNode(std::ostream &os, const MergedNode &node) {
+  const ProfileStats &s = node.stats;
+  os << "{\"name\":";
+  writeJsonString(os, Profiler::nameOf(node.scope));
+  os << ",\"count\":" << s.count << ",\"totalNs\":" << s.total;
+  if (s.count == 0) {
+    // still open when the profile is written
+    os << ",\"open\":true";
+  } else {
+    os << ",\"minNs\":" << s.min << ",\"maxNs\":" << s.max
+       << ",\"meanNs\":" << s.total / s.count
+       << ",\"p50Ns\":" << s.percentile(0.5)
+       << ",\"p90Ns\":" << s.percentile(0.9)
+       << ",\"p99Ns\":" << s.percentile(0.99);
+  }
+  os << ",\"children\":[";
+  bool first = true;
+  for (const MergedNode *child : node.sortedChildren()) {
+    os << (first ? "" : ",");
+    exportNode(os, *child);
+    first = false;
+  }
+  os << "]}";
+}
+
+} // namespace
+
+void ProfileStats::merge(const ProfileStats &other) {
+  count += other.count;
+  total += other.total;
+  min = std::min(min, other.min);
+  max = std::max(max, other.max);
+  for (size_t i = 0; i < nBuckets; i++) {
+    histogram[i] += other.histogram[i];
+  }
+}
+
+uint64_t ProfileStats::percentile(double p) const {
+  if (count == 0) {
+    return 0;
+  }
+  uint64_t rank = std::max<uint64_t>(
+      1, static_cast<uint64_t>(p * static_cast<double>(count) + 0.5));
+  uint64_t seen = 0;
+  for (size_t i = 0; i < nBuckets; i++) {
+    seen += histogram[i];
+    if (seen >= rank) {
+      uint64_t low = bucketLowerBound(i);
+      uint64_t high = bucketLowerBound(i + 1);
+      uint64_t mid = low + (high - low) / 2;
+      return std::clamp(mid, min, max);
+    }
+  }
+  return max;
+}
+
+const std::string &Profiler::nameOf(ProfileScopeId scope) {
+  Names &n = names();
+  std::lock_guard<std::mutex> lock{n.guard};
+  return n.names[scope];
+}
+
+ProfileScopeId Profiler::intern(const char *name) {
+  Names &n = names();
+  std::lock_guard<std::mutex> lock{n.guard};
+  auto it = n.ids.find(name);
+  if (it != n.ids.end()) {
+    return it->second;
+  }
+  ProfileScopeId id = static_cast<ProfileScopeId>(n.names.size());
+  n.names.emplace_back(name);
+  n.ids.emplace(name, id);
+  return id;
+}
+
+void Profiler::enter(ProfileScopeId scope) {
+  ThreadTree &tree = threadTree();
+  // only this thread modifies the tree: no lock needed to read it
+  auto &children = tree.nodes[tree.current].children;
+  for (const auto &[childScope, child] : children) {
+    if (childScope == scope) {
+      tree.current = child;
+      return;
+    }
+  }
+  std::lock_guard<std::mutex> lock{tree.guard};
+  uint32_t child = static_cast<uint32_t>(tree.nodes.size());
+  tree.nodes.push_back({scope, tree.current, {}, {}});
+  tree.nodes[tree.current].children.emplace_back(scope, child);
+  tree.current = child;
+}
+
+void Profiler::leave(uint64_t ns) {
+  ThreadTree &tree = threadTree();
+  {
+    std::lock_guard<std::mutex> lock{tree.guard};
+    tree.nodes[tree.current].stats.add(ns);
+  }
+  tree.current = tree.nodes[tree.current].parent;
+}
+
+void Profiler::report(std::ostream &os) {
+  MergedNode root = mergeTrees();
+  if (root.children.empty()) {
+    return;
+  }
+  auto flags = os.flags();
+  auto precision = os.precision();
+  os << std::fixed << std::setprecision(3);
+  os << std::left << std::setw(40) << "Scope (times in ms)" << std::right
+     << std::setw(10) << "count" << std::setw(12) << "total"
+     << std::setw(8) << "%" << std::setw(11) << "mean" << std::setw(11)
+     << "min" << std::setw(11) << "p50" << std::setw(11) << "p90"
+     << std::setw(11) << "p99" << std::setw(11) << "max"
+     << "\n";
+  for (const MergedNode *child : root.sortedChildren()) {
+    reportNode(os, *child, root.stats.total, 0);
+  }
+  os.flags(flags);
+  os.precision(precision);
+}
+
+void Profiler::exportJson(const std::string &path) {
+  MergedNode root = mergeTrees();
+  std::ofstream out(path, std::ios::trunc);
+  if (!out.is_open()) {
+    messageWarning("Failed to write the profile: " + path);
+    return;
+  }
+  out << "{\"scopes\":[";
+  bool first = true;
+  for (const MergedNode *child : root.sortedChildren()) {
+    out << (first ? "" : ",");
+    exportNode(out, *child);
+    first = false;
+  }
+  out << "]}\n";
+  if (!out) {
+    messageWarning("Failed to write the profile: " + path);
+  }
+}
+
+} // namespace flexer
@@ -0,0 +1,220 @@
+#include "trace.hh"
+
+#include <unistd.h>
+
+#include <algorithm>
+#include <cstdio>
+#include <fstream>
+#include <memory>
+#include <mutex>
+#include <vector>
+
+#include "message.hh"
+#include "profiler.hh"
+
+namespace flexer {
+
+namespace {
+
+struct Event {
+  ///interned name, or the index of name in the strings of the buffer
+  uint32_t scope;
+  bool interned;
+  uint32_t detail;
+  uint64_t startNs;
+  uint64_t endNs;
+};
+
+constexpr uint32_t noDetail = UINT32_MAX;
+
+///events of a thread: written by its thread, read by write()
+struct ThreadBuffer {
+  uint32_t tid;
+  std::string name;
+  std::mutex guard;
+  std::vector<Event> events;
+  std::vector<std::string> strings;
+
+  uint32_t addString(const std::string &s) {
+    strings.push_back(s);
+    return static_cast<uint32_t>(strings.size() - 1);
+  }
+};
+
+struct ProcessEvent {
+  std::string name;
+  pid_t pid;
+  uint64_t startNs;
+  uint64_t endNs;
+  std::string detail;
+};
+
+struct Recorder {
+  uint64_t startNs = 0;
+  std::mutex guard;
+  ///kept after their thread exits
+  std::vector<std::shared_ptr<ThreadBuffer>> buffers;
+  std::vector<ProcessEvent> processes;
+};
+
+Recorder &recorder() {
+  static Recorder *instance = new Recorder();
+  return *instance;
+}
+
+ThreadBuffer &threadBuffer() {
+  thread_local std::shared_ptr<ThreadBuffer> buffer;
+  if (!buffer) {
+    buffer = std::make_shared<ThreadBuffer>();
+    Recorder &r = recorder();
+    std::lock_guard<std::mutex> lock{r.guard};
+    buffer->tid = static_cast<uint32_t>(r.buffers.size() + 1);
+    buffer->name = buffer->tid == 1 ? "main"
+                                    : "thread " + std::to_string(buffer->tid);
+    r.buffers.push_back(buffer);
+  }
+  return *buffer;
+}
+
+void writeJsonString(std::ostream &os, const std::string &s) {
+  static const char hex[] = "0123456789abcdef";
+  os << '"';
+  for (char c : s) {
+    if (c == '"' || c == '\\') {
+      os << '\\' << c;
+    } else if (c == '\n') {
+      os << "\\n";
+    } else if (static_cast<unsigned char>(c) < 0x20) {
+      os << "\\u00" << hex[(c >> 4) & 0xf] << hex[c & 0xf];
+    } else {
+      os << c;
+    }
+  }
+  os << '"';
+}
+
+///microseconds since the start of the trace
+void writeTimestamp(std::ostream &os, uint64_t ns, uint64_t startNs) {
+  uint64_t relative = ns > startNs ? ns - startNs : 0;
+  char buffer[32];
+  snprintf(buffer, sizeof(buffer), "%llu.%03llu",
+           static_cast<unsigned long long>(relative / 1000),
+           static_cast<unsigned long long>(relative % 1000));
+  os << buffer;
+}
+
+void writeEvent(std::ostream &os, const std::string &name, int pid,
+                uint32_t tid, uint64_t startNs, uint64_t endNs,
+                const std::string *detail, uint64_t traceStart) {
+  os << ",\n{\"ph\":\"X\",\"name\":";
+  writeJsonString(os, name);
+  os << ",\"pid\":" << pid << ",\"tid\":" << tid << ",\"ts\":";
+  writeTimestamp(os, startNs, traceStart);
+  os << ",\"dur\":";
+  writeTimestamp(os, std::max(startNs, endNs) - startNs, 0);
+  if (detail) {
+    os << ",\"args\":{\"detail\":";
+    writeJsonString(os, *detail);
+    os << "}";
+  }
+  os << "}";
+}
+
+void writeMetadata(std::ostream &os, const char *kind, int pid,
+                   uint32_t tid, const std::string &name) {
+  os << ",\n{\"ph\":\"M\",\"name\":\"" << kind << "\",\"pid\":" << pid
+     << ",\"tid\":" << tid << ",\"args\":{\"name\":";
+  writeJsonString(os, name);
+  os << "}}";
+}
+
+} // namespace
+
+void Tracer::enable() {
+  recorder().startNs = now();
+  // the thread enabling the trace gets the first track
+  threadBuffer();
+  _enabled.store(true, std::memory_order_relaxed);
+}
+
+void Tracer::setThreadName(const std::string &name) {
+  if (!enabled()) {
+    return;
+  }
+  ThreadBuffer &buffer = threadBuffer();
+  std::lock_guard<std::mutex> lock{buffer.guard};
+  buffer.name = name;
+}
+
+void Tracer::record(uint32_t scope, uint64_t startNs, uint64_t endNs) {
+  ThreadBuffer &buffer = threadBuffer();
+  std::lock_guard<std::mutex> lock{buffer.guard};
+  buffer.events.push_back({scope, true, noDetail, startNs, endNs});
+}
+
+void Tracer::record(const std::string &name, uint64_t startNs,
+                    uint64_t endNs, const std::string &detail) {
+  ThreadBuffer &buffer = threadBuffer();
+  std::lock_guard<std::mutex> lock{buffer.guard};
+  uint32_t nameIndex = buffer.addString(name);
+  uint32_t detailIndex =
+      detail.empty() ? noDetail : buffer.addString(detail);
+  buffer.events.push_back(
+      {nameIndex, false, detailIndex, startNs, endNs});
+}
+
+void Tracer::recordProcess(const std::string &name, pid_t pid,
+                           uint64_t startNs, uint64_t endNs,
+                           const std::string &detail) {
+  Recorder &r = recorder();
+  std::lock_guard<std::mutex> lock{r.guard};
+  r.processes.push_back({name, pid, startNs, endNs, detail});
+}
+
+void Tracer::write(const std::string &path) {
+  std::ofstream out(path, std::ios::trunc);
+  if (!out.is_open()) {
+    messageWarning("Failed to write the trace: " + path);
+    return;
+  }
+
+  Recorder &r = recorder();
+  const int pid = static_cast<int>(getpid());
+  std::lock_guard<std::mutex> lock{r.guard};
+
+  out << "{\"displayTimeUnit\":\"ms\",\"traceEvents\":[\n";
+  out << "{\"ph\":\"M\",\"name\":\"process_name\",\"pid\":" << pid
+      << ",\"tid\":0,\"args\":{\"name\":\"flexer\"}}";
+
+  for (const auto &buffer : r.buffers) {
+    std::lock_guard<std::mutex> bufferLock{buffer->guard};
+    writeMetadata(out, "thread_name", pid, buffer->tid, buffer->name);
+    for (const auto &event : buffer->events) {
+      const std::string &name = event.interned
+                                    ? Profiler::nameOf(event.scope)
+                                    : buffer->strings[event.scope];
+      const std::string *detail = event.detail == noDetail
+                                      ? nullptr
+                                      : &buffer->strings[event.detail];
+      writeEvent(out, name, pid, buffer->tid, event.startNs, event.endNs,
+                 detail, r.startNs);
+    }
+  }
+
+  // each child process is a process of the trace with a single track
+  for (const auto &process : r.processes) {
+    writeMetadata(out, "process_name", process.pid, 0,
+                  process.name + " (" + std::to_string(process.pid) + ")");
+    writeEvent(out, process.name, process.pid, 0, process.startNs,
+               process.endNs,
+               process.detail.empty() ? nullptr : &process.detail,
+               r.startNs);
+  }
+
+  out << "\n]}\n";
+  if (!out) {
+    messageWarning("Failed to write the trace: " + path);
+  }
+}
+
+} // namespace flexer
@@ -0,0 +1,157 @@
+#include <algorithm>
+#include <string>
+#include <vector>
+
+#include "compilerInvocation.hh"
+#include "gtest/gtest.h"
+
+using namespace flexer;
+
+namespace {
+
+using Args = std::vector<std::string>;
+
+bool contains(const Args &args, const std::string &arg) {
+  return std::find(args.begin(), args.end(), arg) != args.end();
+}
+
+} // namespace
+
+TEST(CompilerInvocation, CompilationOfOneSourceIsCacheable) {
+  CompilerInvocation invocation =
+      analyzeInvocation({"g++", "-O2", "-Iinclude", "-c", "src/a.cc", "-o",
+                         "build/a.o"});
+  EXPECT_TRUE(invocation.cacheable);
+  EXPECT_EQ(invocation.output, "build/a.o");
+  EXPECT_TRUE(invocation.depFile.empty());
+  EXPECT_FALSE(invocation.debugInfo);
+  EXPECT_EQ(invocation.preprocess,
+            (Args{"g++", "-O2", "-Iinclude", "src/a.cc", "-E"}));
+}
+
+TEST(CompilerInvocation, DefaultOutputIsInTheWorkingDirectory) {
+  CompilerInvocation invocation =
+      analyzeInvocation({"cc", "-c", "src/a.c"});
+  EXPECT_TRUE(invocation.cacheable);
+  EXPECT_EQ(invocation.output, "a.o");
+}
+
+TEST(CompilerInvocation, AttachedOutput) {
+  CompilerInvocation invocation =
+      analyzeInvocation({"g++", "-c", "a.cc", "-obuild/a.o"});
+  EXPECT_TRUE(invocation.cacheable);
+  EXPECT_EQ(invocation.output, "build/a.o");
+}
+
+TEST(CompilerInvocation, LinksAndSeveralInputsAreNotCacheable) {
+  EXPECT_FALSE(analyzeInvocation({"g++", "a.o", "b.o", "-o", "prog"})
+                   .cacheable);
+  EXPECT_FALSE(analyzeInvocation({"g++", "a.cc", "-o", "prog"}).cacheable);
+  EXPECT_FALSE(
+      analyzeInvocation({"g++", "-c", "a.cc", "b.cc"}).cacheable);
+}
+
+TEST(CompilerInvocation, OtherOutputsAreNotCacheable) {
+  for (const char *option :
+       {"-E", "-S", "-M", "-save-temps", "--coverage", "-xc++", "@args"}) {
+    EXPECT_FALSE(analyzeInvocation({"g++", "-c", "a.cc", option}).cacheable)
+        << option;
+  }
+}
+
+TEST(CompilerInvocation, DependencyFileNextToTheOutput) {
+  CompilerInvocation invocation =
+      analyzeInvocation({"g++", "-MMD", "-c", "a.cc", "-o", "build/a.o"});
+  EXPECT_TRUE(invocation.cacheable);
+  EXPECT_EQ(invocation.depFile, "build/a.d");
+  EXPECT_FALSE(contains(invocation.preprocess, "-MMD"));
+}
+
+TEST(CompilerInvocation, DependencyFileOption) {
+  CompilerInvocation separate = analyzeInvocation(
+      {"g++", "-MD", "-MF", "deps/a.d", "-c", "a.cc", "-o", "a.o"});
+  EXPECT_EQ(separate.depFile, "deps/a.d");
+  EXPECT_FALSE(contains(separate.preprocess, "deps/a.d"));
+
+  CompilerInvocation attached = analyzeInvocation(
+      {"g++", "-MD", "-MFdeps/a.d", "-c", "a.cc", "-o", "a.o"});
+  EXPECT_TRUE(attached.cacheable);
+  EXPECT_EQ(attached.depFile, "deps/a.d");
+  EXPECT_FALSE(contains(attached.preprocess, "-MFdeps/a.d"));
+}
+
+TEST(CompilerInvocation, DependencyFileWithoutDependenciesIsIgnored) {
+  CompilerInvocation invocation =
+      analyzeInvocation({"g++", "-MF", "a.d", "-c", "a.cc"});
+  EXPECT_TRUE(invocation.depFile.empty());
+}
+
+TEST(CompilerInvocation, DependencyTargetsAreNotPreprocessed) {
+  CompilerInvocation invocation = analyzeInvocation(
+      {"g++", "-MD", "-MT", "a.o", "-MTtarget", "-MQ", "b.o", "-MQ$q",
+       "-MP", "-c", "a.cc", "-o", "a.o"});
+  EXPECT_TRUE(invocation.cacheable);
+  EXPECT_EQ(invocation.preprocess, (Args{"g++", "a.cc", "-E"}));
+}
+
+TEST(CompilerInvocation, DebugInfo) {
+  EXPECT_TRUE(analyzeInvocation({"g++", "-g", "-c", "a.cc"}).debugInfo);
+  EXPECT_TRUE(analyzeInvocation({"g++", "-g3", "-c", "a.cc"}).debugInfo);
+  EXPECT_FALSE(
+      analyzeInvocation({"g++", "-g", "-g0", "-c", "a.cc"}).debugInfo);
+}
+
+TEST(CompilationKey, DependsOnEveryInput) {
+  Args args{"g++", "-c", "a.cc"};
+  std::string key = compilationKey("g++\n1\n2", args, false, "int a;");
+  EXPECT_EQ(key.size(), 32u);
+  EXPECT_EQ(key, compilationKey("g++\n1\n2", args, false, "int a;"));
+  EXPECT_NE(key, compilationKey("g++\n1\n3", args, false, "int a;"));
+  EXPECT_NE(key, compilationKey("g++\n1\n2", {"g++", "-O2", "-c", "a.cc"},
+                                false, "int a;"));
+  EXPECT_NE(key, compilationKey("g++\n1\n2", args, false, "int b;"));
+  EXPECT_NE(key, compilationKey("g++\n1\n2", args, true, "int a;"));
+}
+
+TEST(CompilationKey, ArgumentsAreSeparated) {
+  EXPECT_NE(compilationKey("id", {"g++", "-DA", "B"}, false, ""),
+            compilationKey("id", {"g++", "-DAB"}, false, ""));
+}
+
+TEST(CompilationKey, IsTheSameInEveryWorkspace) {
+  auto keyIn = [](const std::string &workspace, const std::string &baseDir,
+                  const std::string &code) {
+    Args args{"g++", "-I" + workspace + "/include", "-c",
+              workspace + "/src/a.cc", "-o", "src/a.o"};
+    std::string preprocessed = "# 1 \"" + workspace + "/src/a.cc\"\n" +
+                               code + "# 2 \"" + workspace +
+                               "/include/a.hh\" 1\nint b;\n";
+    return compilationKey("g++", args, true, preprocessed, baseDir);
+  };
+  std::string first = "/p/.flexer/workspaces/worker-0";
+  std::string second = "/p/.flexer/workspaces/worker-1";
+  EXPECT_EQ(keyIn(first, first, "int a;\n"),
+            keyIn(second, second, "int a;\n"));
+  // FLEXER_WORKSPACE may end with a slash
+  EXPECT_EQ(keyIn(first, first, "int a;\n"),
+            keyIn(second, second + "/", "int a;\n"));
+  EXPECT_NE(keyIn(first, first, "int a;\n"),
+            keyIn(second, second, "int c;\n"));
+  // without a base directory the paths tell the workspaces apart
+  EXPECT_NE(keyIn(first, "", "int a;\n"), keyIn(second, "", "int a;\n"));
+}
+
+TEST(CompilationKey, BaseDirIsOnlyReplacedInLineMarkers) {
+  // __FILE__ expanded in the code makes the objects differ
+  std::string code = "const char *f = \"/w0/a.cc\";\n";
+  std::string other = "const char *f = \"/w1/a.cc\";\n";
+  EXPECT_NE(compilationKey("id", {"g++"}, false, code, "/w0"),
+            compilationKey("id", {"g++"}, false, other, "/w1"));
+}
+
+TEST(CompilationKey, BaseDirMatchesWholeDirectories) {
+  EXPECT_NE(
+      compilationKey("id", {"g++", "-I/w/worker-10"}, false, "", "/w/worker-1"),
+      compilationKey("id", {"g++", "-I/w/worker-20"}, false, "",
+                     "/w/worker-2"));
+}
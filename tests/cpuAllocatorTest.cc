@@ -0,0 +1,122 @@
+#include <sched.h>
+
+#include <set>
+#include <string>
+#include <vector>
+
+#include "cpuAllocator.hh"
+#include "gtest/gtest.h"
+
+using namespace flexer;
+
+namespace {
+
+///cores of one hardware thread each, CPUs 0 to n - 1
+std::vector<CpuAllocator::Core> singleThreadCores(int n) {
+  std::vector<CpuAllocator::Core> cores;
+  for (int cpu = 0; cpu < n; cpu++) {
+    cores.push_back({cpu});
+  }
+  return cores;
+}
+
+///no CPU appears twice among the run sets and the compile set
+void expectDisjoint(const CpuAllocator &allocator) {
+  std::set<int> seen;
+  auto add = [&seen](const std::vector<int> &cpus) {
+    for (int cpu : cpus) {
+      EXPECT_TRUE(seen.insert(cpu).second) << "CPU " << cpu << " given twice";
+    }
+  };
+  for (const auto &set : allocator.runSets()) {
+    add(set);
+  }
+  add(allocator.compileSet());
+}
+
+} // namespace
+
+TEST(CpuList, ParsesRangesAndSingleCpus) {
+  EXPECT_EQ(parseCpuList("0-3,8,10-11"),
+            (std::vector<int>{0, 1, 2, 3, 8, 10, 11}));
+  EXPECT_EQ(parseCpuList("5"), (std::vector<int>{5}));
+  EXPECT_EQ(parseCpuList(""), std::vector<int>());
+}
+
+TEST(CpuList, IgnoresTheSysfsNewline) {
+  EXPECT_EQ(parseCpuList("0,4\n"), (std::vector<int>{0, 4}));
+  EXPECT_EQ(parseCpuList("2-3, 6\n"), (std::vector<int>{2, 3, 6}));
+}
+
+TEST(CpuList, FormatsConsecutiveCpusAsRanges) {
+  EXPECT_EQ(formatCpuList({0, 1, 2, 3, 8, 10, 11}), "0-3,8,10-11");
+  EXPECT_EQ(formatCpuList({7}), "7");
+  EXPECT_EQ(formatCpuList({}), "");
+}
+
+TEST(CpuList, FormatThenParseIsTheIdentity) {
+  std::vector<int> cpus{0, 2, 3, 4, 9, 15, 16};
+  EXPECT_EQ(parseCpuList(formatCpuList(cpus)), cpus);
+}
+
+TEST(CpuListDeathTest, RejectsInvalidLists) {
+  EXPECT_DEATH(parseCpuList("3-1"), "Invalid CPU range");
+  EXPECT_DEATH(parseCpuList("a-b"), "Invalid CPU list");
+}
+
+TEST(CpuListDeathTest, RejectsCpusOutOfTheAffinityMask) {
+  EXPECT_DEATH(parseCpuList("0-2147483647"), "out of range");
+  EXPECT_DEATH(parseCpuList("0," + std::to_string(CPU_SETSIZE)),
+               "out of range");
+  EXPECT_EQ(parseCpuList(std::to_string(CPU_SETSIZE - 1)),
+            std::vector<int>{CPU_SETSIZE - 1});
+}
+
+TEST(CpuAllocator, RunSlotsTakeTheHighestCores) {
+  CpuAllocator allocator(singleThreadCores(8), 2, 2);
+  ASSERT_TRUE(allocator.pinned());
+  ASSERT_EQ(allocator.runSets().size(), 2u);
+  EXPECT_EQ(allocator.runSets()[0], (std::vector<int>{6, 7}));
+  EXPECT_EQ(allocator.runSets()[1], (std::vector<int>{4, 5}));
+  EXPECT_EQ(allocator.compileSet(), (std::vector<int>{0, 1, 2, 3}));
+  expectDisjoint(allocator);
+}
+
+TEST(CpuAllocator, GivesWholeCoresToARunSlot) {
+  // two hardware threads per core, as on an SMT machine
+  std::vector<CpuAllocator::Core> cores{{0, 4}, {1, 5}, {2, 6}, {3, 7}};
+  CpuAllocator allocator(cores, 2, 1);
+  ASSERT_TRUE(allocator.pinned());
+  EXPECT_EQ(allocator.runSets()[0], (std::vector<int>{3, 7}));
+  EXPECT_EQ(allocator.runSets()[1], (std::vector<int>{2, 6}));
+  EXPECT_EQ(allocator.compileSet(), (std::vector<int>{0, 1, 4, 5}));
+  expectDisjoint(allocator);
+}
+
+TEST(CpuAllocator, ReservedCpusExcludeTheirWholeCore) {
+  std::vector<CpuAllocator::Core> cores{{0, 4}, {1, 5}, {2, 6}, {3, 7}};
+  CpuAllocator allocator(cores, 1, 1, {7});
+  ASSERT_TRUE(allocator.pinned());
+  EXPECT_EQ(allocator.runSets()[0], (std::vector<int>{2, 6}));
+  EXPECT_EQ(allocator.compileSet(), (std::vector<int>{0, 1, 4, 5}));
+  expectDisjoint(allocator);
+}
+
+TEST(CpuAllocator, SharesTheCpusWhenThereAreTooFewCores) {
+  // every core would go to the runs, none would be left to the compilers
+  CpuAllocator allocator(singleThreadCores(4), 2, 2);
+  EXPECT_FALSE(allocator.pinned());
+  EXPECT_TRUE(allocator.runSets().empty());
+  EXPECT_EQ(allocator.compileSet(), (std::vector<int>{0, 1, 2, 3}));
+}
+
+TEST(CpuAllocator, NoRunSlotLeavesEverythingToTheCompilers) {
+  CpuAllocator allocator(singleThreadCores(3), 0, 1);
+  EXPECT_FALSE(allocator.pinned());
+  EXPECT_EQ(allocator.compileSet(), (std::vector<int>{0, 1, 2}));
+}
+
+TEST(CpuAllocatorDeathTest, RejectsReservingEveryCore) {
+  EXPECT_DEATH(CpuAllocator(singleThreadCores(2), 1, 1, {0, 1}),
+               "All the cores are reserved");
+}
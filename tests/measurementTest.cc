@@ -0,0 +1,138 @@
+#include <string>
+#include <vector>
+
+#include "gtest/gtest.h"
+#include "measurement.hh"
+
+using namespace flexer;
+
+namespace {
+
+MeasurementController controllerWith(const std::vector<double> &samples,
+                                     RepetitionPolicy policy = {}) {
+  MeasurementController controller(policy);
+  for (double sample : samples) {
+    controller.add(sample);
+  }
+  return controller;
+}
+
+} // namespace
+
+TEST(MeasurementStats, MedianAndMadOfAnOddCount) {
+  const MeasurementStats &stats =
+      controllerWith({5, 1, 3, 100, 2}).stats();
+  EXPECT_EQ(stats.count, 5u);
+  EXPECT_DOUBLE_EQ(stats.median, 3);
+  // deviations 2, 2, 0, 97, 1
+  EXPECT_DOUBLE_EQ(stats.mad, 2);
+  EXPECT_DOUBLE_EQ(stats.min, 1);
+  EXPECT_DOUBLE_EQ(stats.max, 100);
+}
+
+TEST(MeasurementStats, MedianOfAnEvenCountIsTheMiddleMean) {
+  const MeasurementStats &stats = controllerWith({4, 1, 3, 2}).stats();
+  EXPECT_DOUBLE_EQ(stats.median, 2.5);
+  // deviations 1.5, 1.5, 0.5, 0.5
+  EXPECT_DOUBLE_EQ(stats.mad, 1);
+}
+
+TEST(MeasurementStats, NoSamples) {
+  const MeasurementStats &stats = controllerWith({}).stats();
+  EXPECT_EQ(stats.count, 0u);
+  EXPECT_FALSE(stats.converged);
+}
+
+TEST(MeasurementStats, IntervalContainsTheMedian) {
+  const MeasurementStats &stats =
+      controllerWith({10, 11, 9, 10.5, 9.5, 10, 12, 8}).stats();
+  EXPECT_LE(stats.min, stats.ciLow);
+  EXPECT_LE(stats.ciLow, stats.median);
+  EXPECT_LE(stats.median, stats.ciHigh);
+  EXPECT_LE(stats.ciHigh, stats.max);
+}
+
+TEST(MeasurementStats, IdenticalSamplesConvergeAtMinRuns) {
+  RepetitionPolicy policy;
+  policy.minRuns = 3;
+  const MeasurementStats &stats = controllerWith({7, 7, 7}, policy).stats();
+  EXPECT_DOUBLE_EQ(stats.ciLow, 7);
+  EXPECT_DOUBLE_EQ(stats.ciHigh, 7);
+  EXPECT_DOUBLE_EQ(stats.relativeWidth(), 0);
+  EXPECT_TRUE(stats.converged);
+}
+
+TEST(MeasurementStats, IsReproducible) {
+  std::vector<double> samples{3, 1, 4, 1, 5, 9, 2, 6, 5, 3};
+  const MeasurementStats &a = controllerWith(samples).stats();
+  const MeasurementStats &b = controllerWith(samples).stats();
+  EXPECT_EQ(a.ciLow, b.ciLow);
+  EXPECT_EQ(a.ciHigh, b.ciHigh);
+}
+
+TEST(MeasurementStats, AreUpdatedByANewSample) {
+  MeasurementController controller = controllerWith({1, 2, 3});
+  EXPECT_DOUBLE_EQ(controller.stats().median, 2);
+  controller.add(4);
+  EXPECT_EQ(controller.stats().count, 4u);
+  EXPECT_DOUBLE_EQ(controller.stats().median, 2.5);
+}
+
+TEST(MeasurementStats, JsonHasAFullPrecisionWidth) {
+  MeasurementStats stats;
+  stats.count = 2;
+  stats.median = 3;
+  stats.ciLow = 2;
+  stats.ciHigh = 3;
+  EXPECT_NE(stats.toJson().find("\"relativeWidth\":0.333333333,"),
+            std::string::npos)
+      << stats.toJson();
+
+  stats.median = 0;
+  EXPECT_NE(stats.toJson().find("\"relativeWidth\":null,"),
+            std::string::npos)
+      << stats.toJson();
+}
+
+TEST(MeasurementController, RunsAtLeastMinRuns) {
+  RepetitionPolicy policy;
+  policy.minRuns = 5;
+  MeasurementController controller(policy);
+  for (int i = 0; i < 4; i++) {
+    controller.add(1);
+    EXPECT_FALSE(controller.done()) << "after " << i + 1 << " runs";
+  }
+  controller.add(1);
+  EXPECT_TRUE(controller.done());
+}
+
+TEST(MeasurementController, StopsAtMaxRuns) {
+  RepetitionPolicy policy;
+  policy.minRuns = 2;
+  policy.maxRuns = 6;
+  MeasurementController controller(policy);
+  // too noisy to ever converge
+  std::vector<double> samples{1, 100, 1, 100, 1, 100};
+  for (size_t i = 0; i < samples.size(); i++) {
+    EXPECT_FALSE(controller.done()) << "after " << i << " runs";
+    controller.add(samples[i]);
+  }
+  EXPECT_TRUE(controller.done());
+  EXPECT_FALSE(controller.stats().converged);
+}
+
+TEST(MeasurementController, StopsOnceTheIntervalIsNarrow) {
+  RepetitionPolicy policy;
+  policy.minRuns = 3;
+  policy.maxRuns = 100;
+  policy.targetWidth = 0.05;
+  MeasurementController controller(policy);
+  // within 1% of each other
+  std::vector<double> samples{100, 101, 99, 100.5, 99.5};
+  for (double sample : samples) {
+    controller.add(sample);
+  }
+  EXPECT_TRUE(controller.done());
+  EXPECT_TRUE(controller.stats().converged);
+  EXPECT_LE(controller.stats().relativeWidth(), 0.05);
+}
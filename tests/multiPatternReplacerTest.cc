@@ -0,0 +1,109 @@
+#include <random>
+#include <string>
+#include <utility>
+#include <vector>
+
+#include "gtest/gtest.h"
+#include "misc.hh"
+
+namespace {
+
+using Tokens = std::vector<std::pair<std::string, std::string>>;
+
+std::string replaced(const Tokens &tokens, std::string input) {
+  replace(tokens, input);
+  return input;
+}
+
+///leftmost-longest reference: at each position, the longest token
+///starting there (the first one among equal tokens), else the character
+std::string reference(const Tokens &tokens, const std::string &input) {
+  std::string output;
+  size_t i = 0;
+  while (i < input.size()) {
+    const std::pair<std::string, std::string> *best = nullptr;
+    for (const auto &token : tokens) {
+      if (!token.first.empty() &&
+          input.compare(i, token.first.size(), token.first) == 0 &&
+          (!best || token.first.size() > best->first.size())) {
+        best = &token;
+      }
+    }
+    if (best) {
+      output += best->second;
+      i += best->first.size();
+    } else {
+      output += input[i++];
+    }
+  }
+  return output;
+}
+
+} // namespace
+
+TEST(MultiPatternReplacer, ReplacesAfterAFailedPartialMatch) {
+  // the scanner before the automaton returned "ab<0><1>"
+  EXPECT_EQ(replaced({{"aca", "<0>"}, {"b", "<1>"}}, "abacab"),
+            "a<1><0><1>");
+}
+
+TEST(MultiPatternReplacer, LongestTokenWinsAtTheSamePosition) {
+  EXPECT_EQ(replaced({{"ab", "<0>"}, {"abc", "<1>"}}, "abcab"),
+            "<1><0>");
+  EXPECT_EQ(replaced({{"abc", "<1>"}, {"ab", "<0>"}}, "abcab"),
+            "<1><0>");
+}
+
+TEST(MultiPatternReplacer, LeftmostOverlappingMatchWins) {
+  EXPECT_EQ(replaced({{"bc", "<0>"}, {"ab", "<1>"}}, "abc"), "<1>c");
+  // the longer match starts later than the shorter one
+  EXPECT_EQ(replaced({{"a", "<0>"}, {"abcd", "<1>"}, {"bcde", "<2>"}},
+                     "abcde"),
+            "<1>e");
+  EXPECT_EQ(replaced({{"abcd", "<1>"}, {"bc", "<2>"}}, "abce"), "a<2>e");
+}
+
+TEST(MultiPatternReplacer, DuplicateTokensKeepTheFirstSubstitution) {
+  EXPECT_EQ(replaced({{"a", "1"}, {"a", "2"}}, "aba"), "1b1");
+}
+
+TEST(MultiPatternReplacer, EmptyTokensNeverMatch) {
+  EXPECT_EQ(replaced({{"", "x"}, {"b", "y"}}, "abc"), "ayc");
+  EXPECT_EQ(replaced({}, "abc"), "abc");
+}
+
+TEST(MultiPatternReplacer, ReplacementsAreNotRescanned) {
+  EXPECT_EQ(replaced({{"a", "aa"}}, "aba"), "aabaa");
+}
+
+TEST(MultiPatternReplacer, ReusableOnSeveralInputs) {
+  MultiPatternReplacer replacer({{"x", "1"}, {"xy", "2"}});
+  EXPECT_EQ(replacer.replace("xxy"), "12");
+  EXPECT_EQ(replacer.replace("yx"), "y1");
+  EXPECT_EQ(replacer.replace(""), "");
+}
+
+TEST(MultiPatternReplacer, MatchesTheLeftmostLongestReference) {
+  std::mt19937 generator(1);
+  std::uniform_int_distribution<int> letter(0, 2);
+  auto randomString = [&](size_t maxLength) {
+    std::string str(std::uniform_int_distribution<size_t>(0, maxLength)(
+                        generator),
+                    'a');
+    for (auto &c : str) {
+      c = static_cast<char>('a' + letter(generator));
+    }
+    return str;
+  };
+
+  for (int i = 0; i < 20000; i++) {
+    Tokens tokens;
+    size_t nTokens = std::uniform_int_distribution<size_t>(1, 4)(generator);
+    for (size_t t = 0; t < nTokens; t++) {
+      tokens.emplace_back(randomString(4), "<" + std::to_string(t) + ">");
+    }
+    std::string input = randomString(16);
+    ASSERT_EQ(replaced(tokens, input), reference(tokens, input))
+        << "input " << input;
+  }
+}
@@ -0,0 +1,88 @@
+#include <unistd.h>
+
+#include <cstdlib>
+#include <filesystem>
+#include <string>
+#include <vector>
+
+#include "gtest/gtest.h"
+#include "variantScheduler.hh"
+
+using namespace flexer;
+
+namespace {
+
+std::string temporaryDirectory() {
+  std::string pattern =
+      (std::filesystem::temp_directory_path() / "flexer-test-XXXXXX")
+          .string();
+  EXPECT_NE(mkdtemp(pattern.data()), nullptr);
+  return pattern;
+}
+
+SchedulerOptions shortVariants(const std::string &root) {
+  SchedulerOptions options;
+  options.runScript = "true";
+  options.compileSlots = 2;
+  options.runSlots = 2;
+  options.repetitions.minRuns = 1;
+  options.repetitions.maxRuns = 1;
+  options.workspaceRoot = root;
+  return options;
+}
+
+VariantScheduler::Prepare noPreparation() {
+  return [](uint64_t, const std::string &) {
+    return std::vector<std::string>();
+  };
+}
+
+} // namespace
+
+TEST(VariantScheduler, DeliversEveryVariantOnce) {
+  std::string root = temporaryDirectory();
+  std::vector<int> delivered(20, 0);
+  VariantScheduler scheduler(shortVariants(root));
+  scheduler.run(delivered.size(), noPreparation(),
+                [&delivered](VariantResult &&result) {
+                  EXPECT_TRUE(result.success()) << result.run.describe();
+                  EXPECT_TRUE(result.ran);
+                  delivered[result.variant]++;
+                });
+  for (size_t i = 0; i < delivered.size(); i++) {
+    EXPECT_EQ(delivered[i], 1) << "variant " << i;
+  }
+  std::filesystem::remove_all(root);
+}
+
+TEST(VariantScheduler, CanBeDestroyedAsSoonAsRunReturns) {
+  // the threads of the scheduler must not touch it once run returned
+  std::string root = temporaryDirectory();
+  for (int i = 0; i < 20; i++) {
+    size_t delivered = 0;
+    {
+      VariantScheduler scheduler(shortVariants(root));
+      scheduler.run(10, noPreparation(),
+                    [&delivered](VariantResult &&) { delivered++; });
+    }
+    ASSERT_EQ(delivered, 10u) << "iteration " << i;
+  }
+  std::filesystem::remove_all(root);
+}
+
+TEST(VariantScheduler, CanBeDestroyedWithoutScripts) {
+  // the compile stage completes on the preparation threads
+  std::string root = temporaryDirectory();
+  for (int i = 0; i < 20; i++) {
+    SchedulerOptions options = shortVariants(root);
+    options.runScript.clear();
+    size_t delivered = 0;
+    {
+      VariantScheduler scheduler(options);
+      scheduler.run(10, noPreparation(),
+                    [&delivered](VariantResult &&) { delivered++; });
+    }
+    ASSERT_EQ(delivered, 10u) << "iteration " << i;
+  }
+  std::filesystem::remove_all(root);
+}